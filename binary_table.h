@@ -0,0 +1,471 @@
+/*  -*- C++ -*-
+ * binary_table.h -- compact binary format for tables of text fields
+ *
+ * tables (e.g. TSV files) that are read many times can be converted to this
+ * format once (with tsv2bin), so that lines and fields do not need to be
+ * searched for delimiters later: read_table2 detects the format by its
+ * first byte and reads it directly, providing the start and length of each
+ * field along with the line (so that they are not parsed again); numjoin
+ * and hashjoin can also write their output in this format (-f bin), so
+ * that the next tool in a pipe gets the fields already split
+ *
+ * format (all numbers are little endian):
+ *   file header (12 bytes): magic (0x89 'J' 'T' 'B'), version (1 byte, 1),
+ *     delimiter (1 byte, 0 if fields were separated by blanks; lines are
+ *     then written with tabs), flags (1 byte, 1 if the first line is a
+ *     header), reserved (1 byte), sorted field (uint32, 0 if not given)
+ *   row groups of up to group_rows lines, each with a header:
+ *     number of lines (uint32, 0 marks the end of the file), number of
+ *     columns (uint32, the largest number of fields in a line), size of
+ *     the rest of the group (uint64), smallest and largest key (int64,
+ *     only if the sorted field is given)
+ *   followed by (varints are unsigned LEB128, 7 bits in each byte):
+ *     number of fields in each line (varints)
+ *     type of each column (1 byte: 0: string, 1: integer)
+ *     values in integer columns (column by column, zigzag varints)
+ *     length of each string field (varints, line by line), so that the
+ *     start and end of each field in the string data below is known
+ *     string data: fields that are not in integer columns, with the ones
+ *     in the same line joined by the delimiter (so that lines without
+ *     integer columns are stored exactly as they are read back)
+ *
+ * a column is stored as integers in a group if it is present in all lines
+ * and all values are integers written in the canonical way (so that the
+ * original text is reproduced exactly); if the sorted field is given, the
+ * file is sorted on it as 64-bit integers (this is checked by tsv2bin)
+ *
+ * only little endian platforms are supported
+ *
+ * Copyright 2018 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * example usage in C++
+
+write_buffer out(1);
+binary_table_writer<write_buffer> bw(out,'\t');
+bw.start();
+for(...) {
+	for(...) bw.append(field,len);
+	bw.end_row();
+}
+bw.finish();
+
+std::ifstream f(fn,std::ios::binary);
+if(binary_table_reader::is_binary(f)) {
+	binary_table_reader br(f);
+	if(!br.start()) { ... } // handle error, see br.get_error()
+	std::string line;
+	std::vector<std::pair<size_t,size_t> > fields;
+	while(br.next(line,fields)) { ... }
+	if(br.failed()) { ... } // handle error
+}
+
+ */
+
+#ifndef _BINARY_TABLE_H
+#define _BINARY_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <istream>
+#include <string>
+#include <vector>
+#include <utility>
+
+struct binary_table {
+	static const unsigned char magic[4];
+	static const unsigned char version = 1;
+	static const size_t header_size = 12;
+	static const size_t group_header_size = 32;
+	enum { FLAG_HEADER = 1 };
+	enum { COL_STRING = 0, COL_INT = 1 };
+
+	/* parse an integer if it is written in the canonical form (optional
+	 * minus sign, no leading zeros, no "-0") */
+	static bool parse_int(const char* s, size_t len, int64_t& x) {
+		size_t i = 0;
+		bool neg = false;
+		if(len && s[0] == '-') { neg = true; i = 1; }
+		if(i == len || len - i > 19) return false;
+		if(s[i] == '0' && (len - i > 1 || neg)) return false;
+		uint64_t v = 0;
+		for(;i<len;i++) {
+			if(s[i] < '0' || s[i] > '9') return false;
+			v = 10*v + (s[i] - '0');
+		}
+		if(neg) {
+			if(v > (uint64_t)INT64_MAX + 1) return false;
+			x = (int64_t)(0 - v);
+		}
+		else {
+			if(v > (uint64_t)INT64_MAX) return false;
+			x = (int64_t)v;
+		}
+		return true;
+	}
+	/* write x to out (at least 20 characters), returns the length;
+	 * two digits are converted at a time */
+	static size_t format_int(int64_t x, char* out) {
+		static const char digits[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+		char tmp[20];
+		uint64_t v = x < 0 ? 0 - (uint64_t)x : (uint64_t)x;
+		size_t n = 20;
+		while(v >= 100) {
+			size_t d = 2*(v % 100);
+			v /= 100;
+			tmp[--n] = digits[d+1];
+			tmp[--n] = digits[d];
+		}
+		if(v >= 10) {
+			tmp[--n] = digits[2*v+1];
+			tmp[--n] = digits[2*v];
+		}
+		else tmp[--n] = '0' + v;
+		size_t k = 0;
+		if(x < 0) out[k++] = '-';
+		memcpy(out + k,tmp + n,20 - n);
+		return k + 20 - n;
+	}
+	static void put_varint(std::string& s, uint64_t v) {
+		while(v >= 0x80) { s.push_back((char)(v | 0x80)); v >>= 7; }
+		s.push_back((char)v);
+	}
+	static bool get_varint(const unsigned char*& p, const unsigned char* end, uint64_t& v) {
+		v = 0;
+		for(unsigned int shift = 0; shift < 64; shift += 7) {
+			if(p == end) return false;
+			unsigned char c = *p++;
+			v |= (uint64_t)(c & 0x7f) << shift;
+			if(!(c & 0x80)) return true;
+		}
+		return false;
+	}
+	/* signed values are zigzag encoded (small absolute values are short) */
+	static void put_zigzag(std::string& s, int64_t x) {
+		put_varint(s,((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+	}
+	static bool get_zigzag(const unsigned char*& p, const unsigned char* end, int64_t& x) {
+		uint64_t v;
+		if(!get_varint(p,end,v)) return false;
+		x = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+		return true;
+	}
+};
+const unsigned char binary_table::magic[4] = {0x89, 'J', 'T', 'B'};
+
+
+/* write a table in the binary format to out (any object with a
+ * write(const char*, size_t) member, e.g. write_buffer) */
+template<class W>
+class binary_table_writer {
+	protected:
+		W& out;
+		char delim;
+		bool header;
+		unsigned int sort_field;
+		size_t group_rows;
+		bool typed; /* store integer columns as numbers */
+		std::string data; /* fields in the current group */
+		std::vector<uint32_t> ends; /* end of each field in data */
+		std::vector<uint32_t> nfields; /* number of fields in each line */
+		size_t row_fields;
+		int64_t key_min, key_max;
+		bool have_key;
+		uint64_t rows;
+		uint64_t groups;
+		uint64_t int_columns; /* number of columns stored as integers (summed over groups) */
+
+		void write_group() {
+			size_t n = nfields.size();
+			uint32_t ncols = 0;
+			for(uint32_t x : nfields) if(x > ncols) ncols = x;
+			/* find integer columns */
+			std::string types(ncols,(char)(typed ? binary_table::COL_INT : binary_table::COL_STRING));
+			std::vector<std::vector<int64_t> > values(ncols);
+			size_t k = 0;
+			for(size_t r=0;r<n;r++) {
+				for(size_t c=nfields[r];c<ncols;c++) types[c] = binary_table::COL_STRING;
+				for(size_t c=0;c<nfields[r];c++,k++) if(types[c] == binary_table::COL_INT) {
+					size_t start = k ? ends[k-1] : 0;
+					int64_t x;
+					if(binary_table::parse_int(data.data() + start,ends[k] - start,x)) values[c].push_back(x);
+					else types[c] = binary_table::COL_STRING;
+				}
+			}
+			std::string body;
+			for(uint32_t x : nfields) binary_table::put_varint(body,x);
+			body.append(types);
+			for(size_t c=0;c<ncols;c++) if(types[c] == binary_table::COL_INT) {
+				for(int64_t x : values[c]) binary_table::put_zigzag(body,x);
+				int_columns++;
+			}
+			std::string str_data;
+			char sep = delim ? delim : '\t';
+			k = 0;
+			for(size_t r=0;r<n;r++) {
+				bool first = true;
+				for(size_t c=0;c<nfields[r];c++,k++) if(types[c] == binary_table::COL_STRING) {
+					size_t start = k ? ends[k-1] : 0;
+					if(!first) str_data.push_back(sep);
+					str_data.append(data,start,ends[k] - start);
+					binary_table::put_varint(body,ends[k] - start);
+					first = false;
+				}
+			}
+			body.append(str_data);
+
+			char h[binary_table::group_header_size];
+			uint32_t tmp[2] = {(uint32_t)n, ncols};
+			uint64_t size = body.size();
+			int64_t keys[2] = {have_key ? key_min : 0, have_key ? key_max : 0};
+			memcpy(h,tmp,8);
+			memcpy(h+8,&size,8);
+			memcpy(h+16,keys,16);
+			out.write(h,binary_table::group_header_size);
+			out.write(body.data(),body.size());
+
+			rows += n;
+			groups++;
+			data.clear();
+			ends.clear();
+			nfields.clear();
+			have_key = false;
+		}
+
+	public:
+		/* write to out; delim is the delimiter used when reading the lines
+		 * back (0 if fields are separated by blanks); if header is true, the
+		 * first line is a header; if sort_field is not 0, keys given to
+		 * end_row() are stored as metadata (the caller has to ensure that
+		 * lines are sorted by them) */
+		binary_table_writer(W& out_, char delim_, bool header_ = false, unsigned int sort_field_ = 0,
+			size_t group_rows_ = 65536, bool typed_ = false):out(out_),delim(delim_),header(header_),
+			sort_field(sort_field_),group_rows(group_rows_),typed(typed_),row_fields(0),key_min(0),key_max(0),have_key(false),
+			rows(0),groups(0),int_columns(0) { }
+
+		/* write the file header */
+		void start() {
+			char h[binary_table::header_size];
+			memcpy(h,binary_table::magic,4);
+			h[4] = binary_table::version;
+			h[5] = delim;
+			h[6] = header ? binary_table::FLAG_HEADER : 0;
+			h[7] = 0;
+			uint32_t f = sort_field;
+			memcpy(h+8,&f,4);
+			out.write(h,binary_table::header_size);
+		}
+		/* add one field to the current line */
+		void append(const char* s, size_t len) {
+			data.append(s,len);
+			ends.push_back((uint32_t)data.size());
+			row_fields++;
+		}
+		/* finish the current line (without a key) */
+		void end_row() {
+			nfields.push_back((uint32_t)row_fields);
+			row_fields = 0;
+			if(nfields.size() >= group_rows || data.size() >= 64*1048576UL) write_group();
+		}
+		/* finish the current line, with the given key in the sorted field */
+		void end_row(int64_t key) {
+			if(!have_key) key_min = key;
+			key_max = key;
+			have_key = true;
+			end_row();
+		}
+		/* write any remaining lines and the end of the file */
+		void finish() {
+			if(nfields.size()) write_group();
+			char h[binary_table::group_header_size];
+			memset(h,0,binary_table::group_header_size);
+			out.write(h,binary_table::group_header_size);
+		}
+
+		uint64_t get_rows() const { return rows; }
+		uint64_t get_groups() const { return groups; }
+		uint64_t get_int_columns() const { return int_columns; }
+};
+
+
+/* read a table in the binary format from a stream */
+class binary_table_reader {
+	protected:
+		std::istream& is;
+		char delim;
+		bool header;
+		unsigned int sort_field;
+		std::string group; /* data of the current group */
+		std::vector<uint32_t> nfields;
+		std::vector<std::pair<size_t,size_t> > str_fields; /* start and length of each string field in str_data */
+		std::vector<std::vector<int64_t> > values; /* integer columns (empty for string columns) */
+		const char* str_data;
+		uint32_t nrows;
+		uint32_t ncols;
+		uint32_t row; /* next line in the group */
+		uint32_t int_cols; /* number of integer columns in the group */
+		size_t str_idx; /* next string field */
+		bool eof;
+		std::string error;
+
+		bool fail(const char* msg) { error = msg; return false; }
+
+		/* read the next group; returns false on error or at the end */
+		bool read_group() {
+			char h[binary_table::group_header_size];
+			if(!is.read(h,binary_table::group_header_size)) return fail("Unexpected end of binary table");
+			uint32_t tmp[2];
+			uint64_t size;
+			memcpy(tmp,h,8);
+			memcpy(&size,h+8,8);
+			nrows = tmp[0];
+			ncols = tmp[1];
+			row = 0;
+			str_idx = 0;
+			if(nrows == 0) { eof = true; return false; }
+			group.resize(size);
+			if(!is.read(&group[0],size)) return fail("Unexpected end of binary table");
+
+			const unsigned char* p = (const unsigned char*)group.data();
+			const unsigned char* end = p + size;
+			nfields.resize(nrows);
+			size_t nstr = 0; /* number of string fields */
+			for(uint32_t r=0;r<nrows;r++) {
+				uint64_t x;
+				if(!binary_table::get_varint(p,end,x) || x > ncols) return fail("Invalid binary table");
+				nfields[r] = x;
+				nstr += x;
+			}
+			if((size_t)(end - p) < ncols) return fail("Invalid binary table");
+			const unsigned char* types = p;
+			p += ncols;
+			values.resize(ncols);
+			int_cols = 0;
+			for(uint32_t c=0;c<ncols;c++) {
+				values[c].clear();
+				if(types[c] != binary_table::COL_INT) continue;
+				values[c].resize(nrows);
+				for(uint32_t r=0;r<nrows;r++)
+					if(nfields[r] <= c || !binary_table::get_zigzag(p,end,values[c][r])) return fail("Invalid binary table");
+				nstr -= nrows;
+				int_cols++;
+			}
+			str_fields.resize(nstr);
+			size_t total = 0;
+			size_t i = 0;
+			for(uint32_t r=0;r<nrows;r++) {
+				uint32_t n = nfields[r] - int_cols;
+				for(uint32_t c=0;c<n;c++,i++) {
+					uint64_t len;
+					if(!binary_table::get_varint(p,end,len)) return fail("Invalid binary table");
+					if(c) total++; /* delimiter */
+					str_fields[i] = std::make_pair(total,(size_t)len);
+					total += len;
+				}
+			}
+			if(total != (size_t)(end - p)) return fail("Invalid binary table");
+			str_data = (const char*)p;
+			return true;
+		}
+
+	public:
+		explicit binary_table_reader(std::istream& is_):is(is_),delim(0),header(false),sort_field(0),
+			str_data(0),nrows(0),ncols(0),row(0),int_cols(0),str_idx(0),eof(false) { }
+
+		/* check if the data in the given stream might be in this format
+		 * (without consuming any of it) */
+		static bool is_binary(std::istream& is) {
+			return is.peek() == binary_table::magic[0];
+		}
+
+		/* read and check the file header; returns false on error */
+		bool start() {
+			char h[binary_table::header_size];
+			if(!is.read(h,binary_table::header_size) || memcmp(h,binary_table::magic,4))
+				return fail("Invalid binary table header");
+			if(h[4] != binary_table::version) return fail("Unsupported binary table version");
+			delim = h[5];
+			header = h[6] & binary_table::FLAG_HEADER;
+			uint32_t f;
+			memcpy(&f,h+8,4);
+			sort_field = f;
+			return true;
+		}
+
+		/* read the next line into buf and store the start and length of its
+		 * fields in fields; returns false at the end of the input or on error
+		 * (see failed()) */
+		bool next(std::string& buf, std::vector<std::pair<size_t,size_t> >& fields) {
+			if(eof || error.size()) return false;
+			if(row == nrows && !read_group()) return false;
+			uint32_t n = nfields[row];
+			/* all integer columns are present in each line */
+			size_t nstr = n - int_cols;
+			const std::pair<size_t,size_t>* f = str_fields.data() + str_idx;
+			str_idx += nstr;
+			fields.resize(n);
+			if(!int_cols) {
+				/* the line is stored as is */
+				size_t s = n ? f[0].first : 0;
+				buf.assign(str_data + s,n ? f[n-1].first + f[n-1].second - s : 0);
+				for(uint32_t c=0;c<n;c++) fields[c] = std::make_pair(f[c].first - s,f[c].second);
+				row++;
+				return true;
+			}
+			char sep = delim ? delim : '\t';
+			buf.resize((nstr ? f[nstr-1].first + f[nstr-1].second - f[0].first : 0) + 21*int_cols + 1);
+			char* const out = &buf[0];
+			char* p = out;
+			for(uint32_t c=0;c<n;c++) {
+				if(c) *p++ = sep;
+				char* start = p;
+				if(values[c].size()) p += binary_table::format_int(values[c][row],p);
+				else {
+					memcpy(p,str_data + f->first,f->second);
+					p += f->second;
+					f++;
+				}
+				fields[c] = std::make_pair((size_t)(start - out),(size_t)(p - start));
+			}
+			buf.resize(p - out);
+			row++;
+			return true;
+		}
+
+		bool failed() const { return error.size() > 0; }
+		const std::string& get_error() const { return error; }
+		/* delimiter of fields in the lines (0: tab, fields were separated by blanks) */
+		char get_delim() const { return delim; }
+		/* the first line is a header */
+		bool has_header() const { return header; }
+		/* field the file is sorted by (as 64-bit integers), 0 if not known */
+		unsigned int get_sort_field() const { return sort_field; }
+};
+
+#endif
+
@@ -0,0 +1,56 @@
+/*  -*- C++ -*-
+ * field_list.h -- lists of fields given on the command line, by number or
+ *   by name (for JSON input), shared by numjoin and hashjoin
+ */
+
+#ifndef _FIELD_LIST_H
+#define _FIELD_LIST_H
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "read_table_cpp.h"
+
+/* parse a comma-separated list of fields, given by number or by name (for
+ * JSON input, see -J); names are added to names if not there yet and are
+ * stored as negative numbers (-1 for names[0], etc.) until it is known
+ * which inputs are JSON (see ResolveFieldNames()) */
+inline bool ParseFieldList(const char* list, std::vector<int>& fields, std::vector<std::string>& names) {
+	fields.clear();
+	line_parser lp(line_parser_params().set_delim(','),list);
+	std::string s;
+	while(lp.read_string(s)) {
+		if(s.empty()) return false;
+		if(s.find_first_not_of("0123456789") == std::string::npos) {
+			int x = atoi(s.c_str());
+			if(x < 1) return false;
+			fields.push_back(x);
+		}
+		else {
+			size_t k = std::find(names.begin(),names.end(),s) - names.begin();
+			if(k == names.size()) names.push_back(s);
+			fields.push_back(-(int)k - 1);
+		}
+	}
+	return lp.get_last_error() == T_EOL && fields.size();
+}
+
+/* convert the fields given by ParseFieldList() for one input: for JSON
+ * input, all fields have to be names, which are replaced by their
+ * position in json_keys (the members extracted from each line, added as
+ * needed); otherwise, no field can be given by name */
+inline bool ResolveFieldNames(std::vector<int>& fields, const std::vector<std::string>& names,
+		bool json, std::vector<std::string>& json_keys) {
+	for(int& f : fields) {
+		if(!json) { if(f < 1) return false; continue; }
+		if(f > 0) return false;
+		const std::string& name = names[-f-1];
+		size_t k = std::find(json_keys.begin(),json_keys.end(),name) - json_keys.begin();
+		if(k == json_keys.size()) json_keys.push_back(name);
+		f = k + 1;
+	}
+	return true;
+}
+
+#endif
@@ -51,62 +51,14 @@
 #include <string>
 //~ #include <random>
 #include <unordered_map>
+#include <thread>
 #include "read_table_cpp.h"
+#include "write_buffer.h"
+#include "murmurhash.h"
+#include "field_list.h"
 
 
 
-/*-----------------------------------------------------------------------------
- * Murmurhash for strings since C++ hash functions only support std::string
- * slightly modified from
- * https://github.com/aappleby/smhasher/blob/master/src/MurmurHash2.cpp
- * MurmurHash2, 64-bit versions, by Austin Appleby
- * 64-bit hash for 64-bit platforms
- * 
- * MurmurHash2 was written by Austin Appleby, and is placed in the public
- * domain. The author hereby disclaims copyright to this source code.
-*/
-uint64_t MurmurHash64A ( const char * key, size_t len, uint64_t seed )
-{
-	const uint64_t m = 0xc6a4a7935bd1e995UL;
-	const int r = 47;
-	
-	uint64_t h = seed ^ (len * m);
-	
-	while(len >= 8)
-	{
-		/* note: use memcpy() to avoid UB from strict aliasing violation
-		 * should be compiled to a single load instruction */
-		uint64_t k;
-		memcpy(&k,key,8);
-		key += 8;
-		len -= 8;
-		
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m; 
-	}
-	
-	switch(len)
-	{
-		case 7: h ^= uint64_t(key[6]) << 48;
-		case 6: h ^= uint64_t(key[5]) << 40;
-		case 5: h ^= uint64_t(key[4]) << 32;
-		case 4: h ^= uint64_t(key[3]) << 24;
-		case 3: h ^= uint64_t(key[2]) << 16;
-		case 2: h ^= uint64_t(key[1]) << 8;
-		case 1: h ^= uint64_t(key[0]); h *= m;
-	};
-	
-	h ^= h >> r;
-	h *= m;
-	h ^= h >> r;
-	
-	return h;
-}
-
 /* helper class to store read-only string parts
  * (if std::string_view is not available) */
 struct string_view_custom {
@@ -178,6 +130,12 @@ sorted. Output is written in the same order as read from FILE2.
 When FILE1 or FILE2 (not both) is -, read standard input.
   (joining a file that has a literal name of '-' is not supported)
 
+Input files (and standard input) compressed with gzip or zstd are decompressed
+automatically (zstd only if compiled with zstd support); files in the BGZF
+format (e.g. created by bgzip) or the zstd seekable format are decompressed
+using multiple threads.
+Files converted with tsv2bin are detected and read directly as well.
+
   -a FILENUM        also print unpairable lines from file FILENUM, where
                       FILENUM is 1 or 2, corresponding to FILE1 or FILE2
                       In case of -a 1, unmatched lines from FILE1 are written
@@ -186,15 +144,73 @@ When FILE1 or FILE2 (not both) is -, read standard input.
   -2 FIELD          join on this FIELD of file 2
   -j FIELD          equivalent to '-1 FIELD -2 FIELD'
   -t CHAR           use CHAR as input and output field separator
+  -q                fields can be quoted as in CSV files (RFC 4180): fields
+                      between double quotes can contain the separator,
+                      newlines and quotes (written twice); the separator is
+                      a comma if not given with -t; output fields are
+                      quoted if needed
+  -J FILENUM        file FILENUM (1 or 2) is in the JSON Lines format (one
+                      object per line); its fields (in -1, -o1, -P1, etc.)
+                      are given as names of top-level members instead of
+                      numbers (e.g. -J 2 -2 id -o2 id,name); values are used
+                      as text (strings without the quotes), missing members
+                      are empty and the name $ gives the whole line; by
+                      default, all members named are output
+  -w1 WIDTHS        file 1 has fixed-width fields with the given widths
+                      (comma-separated list, e.g. -w1 10,8,32); fields are
+                      found by their position, without searching for
+                      delimiters, leading and trailing spaces are removed;
+                      with WIDTHS:LEN, records are LEN bytes long and are
+                      not separated by newlines (any bytes after the last
+                      field, e.g. a newline, are ignored)
+  -w2 WIDTHS        file 2 has fixed-width fields with the given widths
   -v FILENUM        like -a FILENUM, but suppress joined output lines
   -o1 FIELDS        output these fields from file 1 (FIELDS is a
                       comma-separated list of field)
   -o2 FIELDS        output these fields from file 2
+  -f FORMAT         format of the output: tsv (text, default) or bin: the
+                      binary table format of tsv2bin, which is read
+                      directly by numjoin and hashjoin (also from standard
+                      input), so that joins can be chained with pipes
+                      without writing and splitting text lines again
+                      (e.g. hashjoin -f bin A B | numjoin -S - C); its
+                      fields are separated by -t CHAR when read back;
+                      files given by -U1 and -U2 are still text (not
+                      supported with -p)
+  -O FILE           write the output to FILE instead of standard output
+  -p N PATTERN      write the output to N files instead of standard output,
+                      selected by a hash of the join field, so that all
+                      lines with the same join field are in the same file;
+                      file names are given by PATTERN, with %d replaced by
+                      the number of the file (from 0), e.g.
+                      -p 16 'out-%d.txt'; the header (with -H) is written to
+                      all files; with -W, each file is written by a separate
+                      thread
+  -U1 FILE          write unpaired lines from file 1 to FILE, in the same pass
+                      as the main output (which then contains unpaired lines
+                      only if -a 1 or -v 1 is given as well); e.g.
+                      -O out.txt -U1 only1.txt -U2 only2.txt writes the
+                      joined lines and the unpaired lines from both files
+                      to three separate files
+  -U2 FILE          write unpaired lines from file 2 to FILE
+  -P1 FIELDS        output these fields from file 1 to the file given by -U1
+                      (default: all fields)
+  -P2 FIELDS        output these fields from file 2 to the file given by -U2
   -u                allow non-unique join fields from FILE1 (by default multiple
                       occurrences of the same value is treated as an error)
   -H                treat the first line in both files as field headers,
                       print them without trying to pair them
   -s NUM            use NUM as salt when computing hash of strings
+  -W                write the output in a separate thread, so that reading
+                      and joining can continue while output is written to a
+                      slow destination (e.g. a pipe to a compression program);
+                      statistics about waiting for the writer thread are
+                      written to stderr
+  -Z METHOD[:LEVEL] compress the output with METHOD (gzip or zstd, the
+                      latter only if compiled with zstd support), using
+                      the given compression LEVEL; blocks of the output are
+                      compressed in parallel using all available CPU cores,
+                      the result is a single valid compressed stream
   -h                display this help and exit
 
 Unless -t CHAR is given, leading blanks separate fields and are ignored,
@@ -259,24 +275,6 @@ bool ReadLine(read_table2& sr, size_t field, std::pair<char*,std::vector<string_
 	return true;
 }
 
-template<class string_type>
-static void WriteFields(std::ostream& sw, const std::vector<string_type>& line,
-		const std::vector<int>& fields, bool& firstout, char out_sep) {
-	if(!fields.empty()) for(int f : fields) {
-		if(firstout) { if(!line.empty()) sw<<line[f-1]; }
-		else {
-			if(!line.empty()) sw<<out_sep<<line[f-1];
-			else sw<<out_sep;
-		}
-		firstout = false;
-	}
-	else for(auto& s : line) {
-		if(firstout) sw<<s;
-		else sw<<out_sep<<s;
-		firstout = false;
-	}
-}
-
 int main(int argc, char** args) {
 	const char* file1 = 0;
 	const char* file2 = 0;
@@ -291,12 +289,28 @@ int main(int argc, char** args) {
 	
 	char delim = 0;
 	char comment = 0;
+	char quote = 0; // fields can be quoted as in CSV files (-q)
+	bool json[2] = {false, false}; // input is JSON Lines (-J)
+	std::vector<std::string> json_keys[2]; // members extracted from it
+	std::vector<size_t> widths[2]; // fixed-width fields (-w1, -w2)
+	size_t record_len[2] = {0, 0}; // and record length (if fixed)
+	std::vector<std::string> field_names; // fields given by name (for JSON input)
 	//~ string empty = null;
 	
 	int unpaired = 0; // if 1 or 2, print unpaired lines from the given file
 	bool only_unpaired = false;
+	const char* out_fn = 0; // write the output to this file instead of stdout
+	unsigned int partitions = 0; // or split it into this many files
+	const char* partition_pattern = 0;
+	// separate files for unpaired lines from each file and the fields written there
+	const char* unpaired_fns[2] = {0, 0};
+	std::vector<int> unpaired_fields[2];
 	bool header = false;
 	bool unique = true;
+	bool async_output = false;
+	bool binary_output = false; // write the output as a binary table (-f bin)
+	write_buffer::compression compress = write_buffer::COMPRESS_NONE;
+	int compress_level = -1;
 	uint64_t seed;
 	bool use_seed;
 	
@@ -304,16 +318,17 @@ int main(int argc, char** args) {
 	int i=1;
 	for(;i<argc;i++) if(args[i][0] == '-' && args[i][1] != 0) switch(args[i][1]) {
 		case '1':
-			field1 = atoi(args[i+1]);
-			i++;
-			break;
 		case '2':
-			field2 = atoi(args[i+1]);
-			i++;
-			break;
 		case 'j':
-			field1 = atoi(args[i+1]);
-			field2 = field1;
+			{
+				std::vector<int> tmp;
+				if(!(ParseFieldList(args[i+1],tmp,field_names) && tmp.size() == 1)) {
+					std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use hashjoin -h for help\n";
+					return 1;
+				}
+				if(args[i][1] != '2') field1 = tmp[0];
+				if(args[i][1] != '1') field2 = tmp[0];
+			}
 			i++;
 			break;
 		case 't':
@@ -324,6 +339,25 @@ int main(int argc, char** args) {
 			comment = args[i+1][0];
 			i++;
 			break;
+		case 'q':
+			quote = '"';
+			break;
+		case 'J':
+			{
+				int n = atoi(args[i+1]);
+				if( ! (n == 1 || n == 2) ) { std::cerr<<"-J parameter has to be either 1 or 2\n  use hashjoin -h for help\n"; return 1; }
+				json[n-1] = true;
+			}
+			i++;
+			break;
+		case 'w':
+			if(!(args[i][2] == '1' || args[i][2] == '2')) { std::cerr<<"Invalid parameter: "<<args[i]<<"\n  (use -w1 or -w2)\n  use hashjoin -h for help\n"; return 1; }
+			if(!read_table2::parse_widths(args[i+1],widths[args[i][2]-'1'],record_len[args[i][2]-'1'])) {
+				std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use hashjoin -h for help\n";
+				return 1;
+			}
+			i++;
+			break;
 /*		case 'e':
 			empty = args[i+1];
 			i++;
@@ -351,10 +385,8 @@ int main(int argc, char** args) {
 				// this case it might be necessary to give an empty string
 				// as the argument (i.e. -o1 "")
 				if( !(args[i+1] == 0 || args[i+1][0] == 0 || args[i+1][0] == '-') ) {
-					line_parser lp(line_parser_params().set_delim(','),args[i+1]);
-					int x;
-					while(lp.read(x)) { tmp.push_back(x); if(x > max) max = x; if(x < 1) { valid = false; break; } }
-					if(lp.get_last_error() != T_EOL || tmp.empty()) valid = false;
+					valid = ParseFieldList(args[i+1],tmp,field_names);
+					for(int x : tmp) if(x > max) max = x;
 					empty = false;
 				}
 				if(!valid) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
@@ -371,12 +403,58 @@ int main(int argc, char** args) {
 				if(!(args[i+1] == 0 || args[i+1][0] == '-')) i++;
 			}
 			break;
+		case 'f':
+			if(!strcmp(args[i+1],"bin")) binary_output = true;
+			else if(!strcmp(args[i+1],"tsv")) binary_output = false;
+			else { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use hashjoin -h for help\n"; return 1; }
+			i++;
+			break;
+		case 'O':
+			out_fn = args[i+1];
+			i++;
+			break;
+		case 'p':
+			{
+				if(i + 2 >= argc) { std::cerr<<args[i]<<" needs two parameters\n  use hashjoin -h for help\n"; return 1; }
+				line_parser lp(args[i+1]);
+				if(!(lp.read(read_bounds(partitions,1U,65536U)) && strstr(args[i+2],"%d"))) {
+					std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<" "<<args[i+2]<<"\n  use hashjoin -h for help\n";
+					return 1;
+				}
+				partition_pattern = args[i+2];
+			}
+			i += 2;
+			break;
+		case 'U':
+		case 'P':
+			if(!(args[i][2] == '1' || args[i][2] == '2')) { std::cerr<<"Invalid parameter: "<<args[i]<<"\n  (use "<<args[i][1]<<"1 or "<<args[i][1]<<"2)\n  use hashjoin -h for help\n"; return 1; }
+			if(args[i][1] == 'U') unpaired_fns[args[i][2]-'1'] = args[i+1];
+			else if(!ParseFieldList(args[i+1],unpaired_fields[args[i][2]-'1'],field_names)) {
+				std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use hashjoin -h for help\n";
+				return 1;
+			}
+			i++;
+			break;
 		case 'H':
 			header = true;
 			break;
 		case 'u':
 			unique = false;
 			break;
+		case 'W':
+			async_output = true;
+			break;
+		case 'Z':
+			if(!write_buffer::parse_compression(args[i+1],compress,compress_level)) {
+				std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use hashjoin -h for help\n";
+				return 1;
+			}
+			if(!write_buffer::compression_supported(compress)) {
+				std::cerr<<"Error: "<<args[i+1]<<" compression is not supported in this build\n";
+				return 1;
+			}
+			i++;
+			break;
 		case 's':
 			seed = strtoul(args[i+1],0,10);
 			use_seed = true;
@@ -396,15 +474,91 @@ int main(int argc, char** args) {
 	if(!strcmp(file1,file2)) { std::cerr<<"Error: input files have to be different!\n"; return 1; }
 	if(file1[0] == '-' && file1[1] == 0) file1 = 0;
 	if(file2[0] == '-' && file2[1] == 0) file2 = 0;
-	if(field1 < 1 || field2 < 1) { std::cerr<<"Error: field numbers have to be >= 1!\n"; return 1; }
+	// fields of JSON input are given by name, these are the members
+	// extracted from each line (fields of the converted lines)
+	for(int j=0;j<2;j++) {
+		if(json[j] && widths[j].size()) {
+			std::cerr<<"Error: -J "<<j+1<<" and -w"<<j+1<<" cannot be used together!\n  use hashjoin -h for help\n";
+			return 1;
+		}
+		std::vector<int> key(1,j ? field2 : field1);
+		std::vector<int>& outfields = j ? outfields2 : outfields1;
+		if(!(ResolveFieldNames(key,field_names,json[j],json_keys[j]) &&
+				ResolveFieldNames(outfields,field_names,json[j],json_keys[j]) &&
+				ResolveFieldNames(unpaired_fields[j],field_names,json[j],json_keys[j]))) {
+			std::cerr<<"Error: fields of file "<<j+1<<" have to be given "<<(json[j] ? "by name (JSON input)" :
+				"by number (names can only be used for JSON input, see -J)")<<"!\n  use hashjoin -h for help\n";
+			return 1;
+		}
+		(j ? field2 : field1) = key[0];
+		int& req = j ? req_fields2 : req_fields1;
+		req = 1;
+		for(int x : outfields) if(x > req) req = x;
+		if(widths[j].size()) {
+			// fixed-width input has exactly the fields given
+			int max = std::max(req,key[0]);
+			for(int x : unpaired_fields[j]) if(x > max) max = x;
+			if((size_t)max > widths[j].size()) {
+				std::cerr<<"Error: file "<<j+1<<" has only "<<widths[j].size()<<" fields (-w"<<j+1<<")!\n  use hashjoin -h for help\n";
+				return 1;
+			}
+		}
+	}
+	if(partitions && out_fn) { std::cerr<<"Error: -O and -p cannot be used together!\n  use hashjoin -h for help\n"; return 1; }
+	if(partitions && binary_output) { std::cerr<<"Error: -f bin and -p cannot be used together!\n  use hashjoin -h for help\n"; return 1; }
+	if(quote && !delim) delim = ',';
 	
 	if(field1 > req_fields1) req_fields1 = field1;
 	if(field2 > req_fields2) req_fields2 = field2;
+	for(int j=0;j<2;j++) {
+		if(unpaired_fields[j].size() && !unpaired_fns[j]) {
+			std::cerr<<"Error: -P"<<j+1<<" given without -U"<<j+1<<"!\n  use hashjoin -h for help\n";
+			return 1;
+		}
+		int& req = j ? req_fields2 : req_fields1;
+		for(int x : unpaired_fields[j]) if(x > req) req = x;
+	}
 	
-	// open input files + set output stream
-	auto& sw = std::cout;
-	read_table2 s1(file1,std::cin,line_parser_params().set_delim(delim).set_comment(comment));
-	read_table2 s2(file2,std::cin,line_parser_params().set_delim(delim).set_comment(comment));
+	// open input files + set output streams
+	// (the available threads for compression are divided among nout outputs)
+	auto open_output = [&](write_buffer& out, const char* fn, unsigned int nout) -> bool {
+		if(fn && !out.open_file(fn)) {
+			std::cerr<<"Error opening output file "<<fn<<": "<<out.get_error_str()<<"\n";
+			return false;
+		}
+		if(compress != write_buffer::COMPRESS_NONE) {
+			if(!out.start_compress(compress,compress_level,std::thread::hardware_concurrency() / nout)) {
+				std::cerr<<"Error setting up output compression\n";
+				return false;
+			}
+		}
+		else if(async_output && !out.start_async(4))
+			std::cerr<<"Cannot start writer thread, writing output directly\n";
+		return true;
+	};
+	write_buffer sw(1);
+	write_buffer sw_unpaired1(1);
+	write_buffer sw_unpaired2(1);
+	partitioned_output parts;
+	if(partitions) {
+		parts.init(partitions,partition_pattern);
+		for(size_t j=0;j<parts.size();j++)
+			if(!open_output(parts[j],parts.fns[j].c_str(),parts.size())) return 1;
+	}
+	else if(!open_output(sw,out_fn,1)) return 1;
+	if(unpaired_fns[0] && !open_output(sw_unpaired1,unpaired_fns[0],1)) return 1;
+	if(unpaired_fns[1] && !open_output(sw_unpaired2,unpaired_fns[1],1)) return 1;
+	// main output for lines with the given join key
+	auto get_output = [&](const string_view_custom& key) -> write_buffer& {
+		return parts.size() ? parts.get(partitioned_output::hash(key.data(),key.size())) : sw;
+	};
+	auto get_params = [&](int j) {
+		if(json[j]) return line_parser_params().set_delim('\t').set_json_keys(&json_keys[j]);
+		if(widths[j].size()) return line_parser_params().set_delim('\t').set_widths(&widths[j],record_len[j]);
+		return line_parser_params().set_delim(delim).set_comment(comment).set_quote(quote);
+	};
+	read_table2 s1(file1,std::cin,get_params(0));
+	read_table2 s2(file2,std::cin,get_params(1));
 	
 	string_view_custom_hash hash;
 	if(use_seed) hash = string_view_custom_hash(seed);
@@ -415,6 +569,34 @@ int main(int argc, char** args) {
 	
 	char out_sep = '\t';
 	if(delim) out_sep = delim;
+	// consecutive output fields can be copied at once if they are
+	// separated by one character in the input, which is used in the output;
+	// lines from file 2 are written as-is if all fields are needed and there
+	// are no comments (then only the fields up to the join field are split)
+	// (with -q, fields are written one by one, quoted if needed; lines
+	// converted from JSON or fixed-width input have fields separated by tabs)
+	bool converted[2] = {json[0] || widths[0].size(), json[1] || widths[1].size()};
+	bool merge1 = converted[0] ? out_sep == '\t' : delim != 0;
+	bool merge2 = converted[1] ? out_sep == '\t' : delim != 0;
+	bool whole_line_ok2 = merge2 && (converted[1] || comment == 0);
+	output_plan plan1(outfields1,outfields1_empty,out_sep,merge1,false,quote);
+	output_plan plan2(outfields2,outfields2_empty,out_sep,merge2,whole_line_ok2 && !binary_output,quote);
+	bool whole_line2 = plan2.writes_whole_line();
+	output_plan unpaired_plan1(unpaired_fields[0],false,out_sep,merge1,false,quote);
+	output_plan unpaired_plan2(unpaired_fields[1],false,out_sep,merge2,whole_line_ok2,quote);
+	// all fields need to be split in lines from file 1 if all of them are
+	// written to the output, and in lines from file 2 if they are not
+	// written as-is
+	bool all_fields1 = outfields1.empty() || (unpaired_fns[0] && unpaired_fields[0].empty());
+	bool all_fields2 = (outfields2.empty() && !whole_line2) ||
+		(unpaired_fns[1] && unpaired_fields[1].empty() && !unpaired_plan2.writes_whole_line());
+	
+	// with -f bin, output lines are added to a binary table field by field
+	std::unique_ptr<binary_table_writer<write_buffer> > bin;
+	if(binary_output) {
+		bin.reset(new binary_table_writer<write_buffer>(sw,delim,header));
+		bin->start();
+	}
 	
 	// read all lines from file 1
 	if(header) {
@@ -430,7 +612,7 @@ int main(int argc, char** args) {
 	while(true) {
 		std::pair<char*,std::vector<string_view_custom> > tmp;
 		size_t read_fields = req_fields1;
-		if(outfields1.empty()) read_fields = 0;
+		if(all_fields1) read_fields = 0;
 		if(!ReadLine(s1,read_fields,tmp)) break; /* end of file or error */
 		if(!read_fields) {
 			if(tmp.second.size() < field1) {
@@ -460,90 +642,179 @@ int main(int argc, char** args) {
 			if(!s2.read_string(tmp)) { std::cerr<<"Error reading header from file 1:\n"; s2.write_error(std::cerr); return 1; }
 			file2header.push_back(std::move(tmp));
 		}
-		bool firstout = true;
-		if(!outfields1_empty) WriteFields(sw,file1header,outfields1,firstout,out_sep);
-		if(!outfields2_empty) WriteFields(sw,file2header,outfields2,firstout,out_sep);
+		auto write_header = [&](write_buffer& out) {
+			if(bin) {
+				plan1.append(*bin,file1header);
+				plan2.append(*bin,file2header);
+				bin->end_row();
+				return;
+			}
+			bool firstout = true;
+			plan1.write(out,file1header,firstout);
+			plan2.write(out,file2header,firstout);
+			out.put('\n');
+		};
+		if(parts.size()) for(size_t j=0;j<parts.size();j++) write_header(parts[j]);
+		else write_header(sw);
+		bool firstout;
+		if(unpaired_fns[0]) {
+			firstout = true;
+			unpaired_plan1.write(sw_unpaired1,file1header,firstout);
+			sw_unpaired1.put('\n');
+		}
+		if(unpaired_fns[1]) {
+			firstout = true;
+			unpaired_plan2.write(sw_unpaired2,file2header,firstout);
+			sw_unpaired2.put('\n');
+		}
 	}
 	
 	uint64_t out_lines = 0;
 	uint64_t matched1 = 0;
 	uint64_t matched2 = 0;
-	uint64_t unmatched = 0;
+	uint64_t unmatched1 = 0;
+	uint64_t unmatched2 = 0;
+	uint64_t unpaired_lines1 = 0; // lines written to the separate files
+	uint64_t unpaired_lines2 = 0;
 	std::vector<string_view_custom> line2(req_fields2);
+	bool read_error = false; // file 2 could not be read (e.g. failed decompression)
 	while(true) {
 		// read one line from file 2, process it
 		if(!s2.read_line()) {
-			if(s2.get_last_error() != T_EOF) s2.write_error(std::cerr);
+			if(s2.get_last_error() != T_EOF) {
+				std::cerr<<"Error reading data from file 2:\n";
+				s2.write_error(std::cerr);
+				read_error = true;
+			}
 			break;
 		}
-		if(outfields2.empty()) line2.clear();
+		if(all_fields2) line2.clear();
 		if(!ParseLine(s2,line2)) {
 			s2.write_error(std::cerr);
 			break;
 		}
-		if(outfields2.empty() && line2.size() < field2)  {
+		if(all_fields2 && line2.size() < field2)  {
 			std::cerr<<"Too few fields in file 2 ("<<(file2?file2:"<stdin>")<<"), line "<<s2.get_line()<<"!\n";
 			break;
 		}
 		const string_view_custom& key = line2[field2-1];
+		write_buffer& out = get_output(key);
 		auto it = dict.find(key);
 		if(it != dict.end()) {
 			File1Line& match = it->second;
 			if(!only_unpaired) {
 				if(!match.seen) matched1 += match.lines.size();
 				for(const auto& line1 : match.lines) {
+					out_lines++;
+					if(bin) {
+						plan1.append(*bin,line1.second);
+						plan2.append(*bin,line2);
+						bin->end_row();
+						continue;
+					}
 					bool firstout = true;
 					
 					// write out fields from the first file
-					if(!outfields1_empty) WriteFields(sw,line1.second,outfields1,firstout,out_sep);
-					if(!outfields2_empty) WriteFields(sw,line2,outfields2,firstout,out_sep);
-					sw<<'\n';
-					out_lines++;
+					plan1.write(out,line1.second,firstout);
+					if(whole_line2) plan2.write_line(out,s2.get_line_c_str(),s2.get_line_str().size(),firstout);
+					else plan2.write(out,line2,firstout);
+					out.put('\n');
 				}
 			}
 			match.seen = true;
 			matched2++;
 		}
-		else if(unpaired == 2) {
-			// still print unpaired lines from file 2
-			bool firstout = true;
-			// note: we write empty fields for file 1
-			if(!outfields1.empty()) WriteFields(sw,std::vector<string_view_custom>(),outfields1,firstout,out_sep);
-			if(!outfields2_empty) WriteFields(sw,line2,outfields2,firstout,out_sep);
-			sw<<'\n';
-			out_lines++;
-			unmatched++;
+		else {
+			if(unpaired == 2) {
+				// still print unpaired lines from file 2
+				// note: we write empty fields for file 1
+				if(bin) {
+					plan1.append_empty(*bin);
+					plan2.append(*bin,line2);
+					bin->end_row();
+				}
+				else {
+					bool firstout = true;
+					plan1.write_empty(out,firstout);
+					if(whole_line2) plan2.write_line(out,s2.get_line_c_str(),s2.get_line_str().size(),firstout);
+					else plan2.write(out,line2,firstout);
+					out.put('\n');
+				}
+				out_lines++;
+				unmatched2++;
+			}
+			if(unpaired_fns[1]) {
+				// write to the separate file of unpaired lines
+				bool firstout = true;
+				if(unpaired_plan2.writes_whole_line())
+					unpaired_plan2.write_line(sw_unpaired2,s2.get_line_c_str(),s2.get_line_str().size(),firstout);
+				else unpaired_plan2.write(sw_unpaired2,line2,firstout);
+				sw_unpaired2.put('\n');
+				unpaired_lines2++;
+			}
 		}
 	} // main loop
 	
 	// write out unmatched lines from file 1 if needed
-	if(unpaired == 1) {
-		for(const auto& x : dict) if(x.second.seen == false)
+	if(unpaired == 1 || unpaired_fns[0]) {
+		for(const auto& x : dict) if(x.second.seen == false) {
+			write_buffer& out = get_output(x.first);
 			for(const auto& line1 : x.second.lines) {
-				// still print unpaired lines from file 1
-				bool firstout = true;
-				if(!outfields1_empty) WriteFields(sw,line1.second,outfields1,firstout,out_sep);
-				// note: we write empty fields for file 2
-				if(!outfields2.empty()) WriteFields(sw,std::vector<string_view_custom>(),outfields2,firstout,out_sep);
-				sw<<'\n';
-				out_lines++;
-				unmatched++;
+				if(unpaired == 1) {
+					// still print unpaired lines from file 1
+					// note: we write empty fields for file 2
+					if(bin) {
+						plan1.append(*bin,line1.second);
+						plan2.append_empty(*bin);
+						bin->end_row();
+					}
+					else {
+						bool firstout = true;
+						plan1.write(out,line1.second,firstout);
+						plan2.write_empty(out,firstout);
+						out.put('\n');
+					}
+					out_lines++;
+					unmatched1++;
+				}
+				if(unpaired_fns[0]) {
+					bool firstout = true;
+					unpaired_plan1.write(sw_unpaired1,line1.second,firstout);
+					sw_unpaired1.put('\n');
+					unpaired_lines1++;
+				}
+			}
 		}
 	}
 	
 	
-	sw.flush(); // flush output
+	int ret = read_error ? 1 : 0;
+	if(bin) bin->finish();
+	if(!sw.finish()) {
+		std::cerr<<"Error writing output: "<<sw.get_error_str()<<"\n";
+		ret = 1;
+	}
+	sw.write_stats(std::cerr);
+	for(size_t j=0;j<parts.size();j++) if(!parts[j].finish()) {
+		std::cerr<<"Error writing output file "<<parts.fns[j]<<": "<<parts[j].get_error_str()<<"\n";
+		ret = 1;
+	}
+	if(unpaired_fns[0] && !sw_unpaired1.finish()) {
+		std::cerr<<"Error writing output file "<<unpaired_fns[0]<<": "<<sw_unpaired1.get_error_str()<<"\n";
+		ret = 1;
+	}
+	if(unpaired_fns[1] && !sw_unpaired2.finish()) {
+		std::cerr<<"Error writing output file "<<unpaired_fns[1]<<": "<<sw_unpaired2.get_error_str()<<"\n";
+		ret = 1;
+	}
+	if(ret) return ret;
 	
+	if(unpaired_fns[0]) std::cerr<<"Unpaired lines from file 1 written to "<<unpaired_fns[0]<<": "<<unpaired_lines1<<'\n';
+	if(unpaired_fns[1]) std::cerr<<"Unpaired lines from file 2 written to "<<unpaired_fns[1]<<": "<<unpaired_lines2<<'\n';
 	std::cerr<<"Matched lines from file 1: "<<matched1<<'\n';
 	std::cerr<<"Matched lines from file 2: "<<matched2<<'\n';
-	if(unmatched > 0) switch(unpaired) {
-		case 1:
-			std::cerr<<"Unmatched lines from file 1: "<<unmatched<<'\n';
-			break;
-		case 2:
-			std::cerr<<"Unmatched lines from file 2: "<<unmatched<<'\n';
-			break;
-	}
+	if(unmatched1 > 0) std::cerr<<"Unmatched lines from file 1: "<<unmatched1<<'\n';
+	if(unmatched2 > 0) std::cerr<<"Unmatched lines from file 2: "<<unmatched2<<'\n';
 	std::cerr<<"Total lines output: "<<out_lines<<'\n';
 }
 
@@ -0,0 +1,172 @@
+/*  -*- C++ -*-
+ * json_lines.h -- extract top-level members from JSON objects, one per line
+ *   (JSON Lines input of numjoin and hashjoin)
+ *
+ * only the structure of the object is scanned to find the requested
+ * members (no values are parsed and nothing is stored besides their
+ * position); string contents are skipped with memchr(), so long strings
+ * are passed quickly; scanning stops once all requested members are found
+ *
+ * values are extracted as-is: strings without the quotes (escape sequences
+ * are not decoded), other values (numbers, true / false / null, nested
+ * objects and arrays) as written, with any tabs and newlines replaced by
+ * spaces (they can only be whitespace in valid JSON), so that the result
+ * can be used as a tab-separated line; missing members are empty; if a
+ * member is present more than once, the first one is used
+ *
+ * the special name "$" gives the whole line
+ *
+ * Copyright 2018 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * example usage in C++
+
+std::vector<std::string> keys = {"id", "name"};
+json_lines jl(keys);
+std::string out;
+if(jl.extract(line.data(),line.size(),out,'\t')) { ... } // out is e.g. "123\tabc"
+
+ */
+
+#ifndef _JSON_LINES_H
+#define _JSON_LINES_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+class json_lines {
+	protected:
+		const std::vector<std::string>& keys;
+		std::vector<std::pair<const char*,size_t> > values; /* values found in the current line */
+
+		static const char* skip_ws(const char* p, const char* end) {
+			while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+			return p;
+		}
+		/* p points after the opening quote of a string; returns the
+		 * position of the closing quote or NULL */
+		static const char* string_end(const char* p, const char* end) {
+			while(true) {
+				const char* q = (const char*)memchr(p,'"',end - p);
+				if(!q) return 0;
+				/* escaped if preceded by an odd number of backslashes */
+				const char* b = q;
+				while(b > p && b[-1] == '\\') b--;
+				if(!((q - b) & 1)) return q;
+				p = q + 1;
+			}
+		}
+		/* returns the end of the value starting at p or NULL if invalid */
+		static const char* value_end(const char* p, const char* end) {
+			if(p == end) return 0;
+			if(*p == '"') {
+				const char* q = string_end(p + 1,end);
+				return q ? q + 1 : 0;
+			}
+			if(*p == '{' || *p == '[') {
+				/* only brackets outside of strings need to be counted */
+				size_t depth = 0;
+				for(; p < end; p++) {
+					char c = *p;
+					if(c == '"') {
+						p = string_end(p + 1,end);
+						if(!p) return 0;
+					}
+					else if(c == '{' || c == '[') depth++;
+					else if(c == '}' || c == ']') if(--depth == 0) return p + 1;
+				}
+				return 0;
+			}
+			/* number or literal */
+			const char* q = p;
+			for(; q < end; q++) if(*q == ',' || *q == '}' || *q == ']' || *q == ' ' ||
+				*q == '\t' || *q == '\n' || *q == '\r') break;
+			return q > p ? q : 0;
+		}
+		/* add s to out, replacing tabs and newlines with spaces */
+		static void append_value(std::string& out, const char* s, size_t len) {
+			size_t start = out.size();
+			out.append(s,len);
+			for(size_t i=start;i<out.size();i++)
+				if(out[i] == '\t' || out[i] == '\n' || out[i] == '\r') out[i] = ' ';
+		}
+
+	public:
+		/* keys: names of the members to extract (this reference is stored) */
+		explicit json_lines(const std::vector<std::string>& keys_):keys(keys_),values(keys_.size()) { }
+
+		/* find the requested members in the object in line and write their
+		 * values to out, separated by sep; returns false if the line is not
+		 * a valid JSON object (as far as it was scanned) */
+		bool extract(const char* line, size_t len, std::string& out, char sep) {
+			const char* p = line;
+			const char* end = line + len;
+			size_t remaining = 0;
+			for(size_t i=0;i<keys.size();i++) {
+				if(keys[i] == "$") values[i] = std::make_pair(line,len);
+				else { values[i] = std::make_pair((const char*)0,(size_t)0); remaining++; }
+			}
+			p = skip_ws(p,end);
+			if(p == end || *p != '{') return false;
+			p = skip_ws(p + 1,end);
+			if(p < end && *p == '}') remaining = 0; /* empty object */
+			while(remaining) {
+				/* member name */
+				if(p == end || *p != '"') return false;
+				const char* k = p + 1;
+				const char* ke = string_end(k,end);
+				if(!ke) return false;
+				p = skip_ws(ke + 1,end);
+				if(p == end || *p != ':') return false;
+				p = skip_ws(p + 1,end);
+				const char* v = p;
+				p = value_end(p,end);
+				if(!p) return false;
+				size_t klen = ke - k;
+				for(size_t i=0;i<keys.size();i++)
+					if(!values[i].first && keys[i].size() == klen && !memcmp(keys[i].data(),k,klen)) {
+						if(*v == '"') values[i] = std::make_pair(v + 1,(size_t)(p - v - 2));
+						else values[i] = std::make_pair(v,(size_t)(p - v));
+						remaining--;
+					}
+				p = skip_ws(p,end);
+				if(p == end) return false;
+				if(*p == '}') break;
+				if(*p != ',') return false;
+				p = skip_ws(p + 1,end);
+			}
+			out.clear();
+			for(size_t i=0;i<keys.size();i++) {
+				if(i) out.push_back(sep);
+				if(values[i].first) append_value(out,values[i].first,values[i].second);
+			}
+			return true;
+		}
+};
+
+#endif
+
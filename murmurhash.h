@@ -0,0 +1,65 @@
+/*  -*- C++ -*-
+ * murmurhash.h -- 64-bit MurmurHash2, used for hashing strings (e.g. join
+ *   keys in hashtables and for partitioning the output)
+ */
+
+#ifndef _MURMURHASH_H
+#define _MURMURHASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*-----------------------------------------------------------------------------
+ * Murmurhash for strings since C++ hash functions only support std::string
+ * slightly modified from
+ * https://github.com/aappleby/smhasher/blob/master/src/MurmurHash2.cpp
+ * MurmurHash2, 64-bit versions, by Austin Appleby
+ * 64-bit hash for 64-bit platforms
+ * 
+ * MurmurHash2 was written by Austin Appleby, and is placed in the public
+ * domain. The author hereby disclaims copyright to this source code.
+*/
+inline uint64_t MurmurHash64A ( const char * key, size_t len, uint64_t seed )
+{
+	const uint64_t m = 0xc6a4a7935bd1e995UL;
+	const int r = 47;
+	
+	uint64_t h = seed ^ (len * m);
+	
+	while(len >= 8)
+	{
+		/* note: use memcpy() to avoid UB from strict aliasing violation
+		 * should be compiled to a single load instruction */
+		uint64_t k;
+		memcpy(&k,key,8);
+		key += 8;
+		len -= 8;
+		
+		k *= m; 
+		k ^= k >> r; 
+		k *= m; 
+		
+		h ^= k;
+		h *= m; 
+	}
+	
+	switch(len)
+	{
+		case 7: h ^= uint64_t(key[6]) << 48;
+		case 6: h ^= uint64_t(key[5]) << 40;
+		case 5: h ^= uint64_t(key[4]) << 32;
+		case 4: h ^= uint64_t(key[3]) << 24;
+		case 3: h ^= uint64_t(key[2]) << 16;
+		case 2: h ^= uint64_t(key[1]) << 8;
+		case 1: h ^= uint64_t(key[0]); h *= m;
+	};
+	
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	
+	return h;
+}
+
+#endif
+
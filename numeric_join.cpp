@@ -44,89 +44,819 @@
 
 
 #include <iostream>
+#include <sstream>
+#include <fstream>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <string.h>
 #include <string>
+#include <glob.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <type_traits>
 #include "read_table_cpp.h"
+#include "write_buffer.h"
+#include "write_arrow.h"
+#include "field_list.h"
 
 
 	
-const char usage[] = R"!!!(Usage: numjoin [OPTION]... FILE1 FILE2
+const char usage[] = R"!!!(Usage: numjoin [OPTION]... FILE1 FILE2 [FILE3]...
 For each pair of input lines with identical join fields, write a line to
 standard output.  The default join field is the first, delimited by blanks.
-The join field has to be an integer and both files need to be sorted on the
-join fields (in numeric order).
+The join field has to be a number (an integer by default, see -k) and both
+files need to be sorted on the join fields (in numeric order).
 
-When FILE1 or FILE2 (not both) is -, read standard input.
+If more than two files are given, they are all joined in one pass: one line is
+written for each combination of input lines that have identical join fields
+in all files.
+
+When one of the files (not more) is -, read standard input.
   (joining a file that has a literal name of '-' is not supported)
 
+Input files (and standard input) compressed with gzip or zstd are decompressed
+automatically (zstd only if compiled with zstd support); files in the BGZF
+format (e.g. created by bgzip) or the zstd seekable format are decompressed
+using multiple threads.
+Files converted with tsv2bin are detected and read directly as well (with -S,
+files converted with tsv2bin -k FIELD are not sorted again if joined on FIELD
+with integer keys).
+
+Each FILE can also be a set of files that are each sorted on the join field
+(e.g. shards of a larger file); these are merged while reading. A set of files
+can be given as a wildcard pattern (quoted to avoid expansion by the shell,
+e.g. 'data/part-*.txt') or as @LIST where LIST is a file containing the names
+of the files, one per line. The first line of each of these is a header if -H
+is given.
+
   -a FILENUM        also print unpairable lines from file FILENUM, where
                       FILENUM is 1 or 2, corresponding to FILE1 or FILE2
+                      (or the number of any input file if there are more);
+                      can be given multiple times
   -e EMPTY          replace missing input fields with EMPTY
   -1 FIELD          join on this FIELD of file 1
   -2 FIELD          join on this FIELD of file 2
-  -j FIELD          equivalent to '-1 FIELD -2 FIELD'
+  -N FIELD          join on this FIELD of file N (for any N)
+  -j FIELD          equivalent to '-1 FIELD -2 FIELD' (for all files)
+                      FIELD can also be a comma-separated list of up to 4
+                      fields (e.g. -j 1,3) to join on all of them; files
+                      then need to be sorted on these fields in this order
+  -k TYPE           type of the join field(s), one of: int (64-bit signed
+                      integer, default), uint (64-bit unsigned integer),
+                      double (floating point number, requires files sorted
+                      with sort -g), decimal:N (fixed point decimal number
+                      with at most N digits after the decimal point),
+                      time (ISO-8601 timestamp, e.g. 2024-05-01T12:00:00.123Z,
+                      or seconds since the epoch; timestamps with different
+                      time zones are compared correctly, the files need to be
+                      sorted by the actual time) or string (any string,
+                      compared byte by byte; files need to be sorted with
+                      LC_ALL=C sort)
   -t CHAR           use CHAR as input and output field separator
+  -q                fields can be quoted as in CSV files (RFC 4180): fields
+                      between double quotes can contain the separator,
+                      newlines and quotes (written twice); the separator is
+                      a comma if not given with -t; output fields are
+                      quoted if needed
   -C CHAR			use CHAR as comment indicator: lines beginning with
 					  CHAR are ignored
+  -J FILENUM        file FILENUM is in the JSON Lines format (one object per
+                      line); its fields (in -N, -oN, -PN, etc.) are given
+                      as names of top-level members instead of numbers
+                      (e.g. -J 2 -2 id -o2 id,name); values are used as
+                      text (strings without the quotes), missing members
+                      are empty and the name $ gives the whole line; by
+                      default, all members named are output
+  -wN WIDTHS        file N has fixed-width fields with the given widths
+                      (comma-separated list, e.g. -w2 10,8,32); fields are
+                      found by their position, without searching for
+                      delimiters, leading and trailing spaces are removed;
+                      with WIDTHS:LEN, records are LEN bytes long and are
+                      not separated by newlines (any bytes after the last
+                      field, e.g. a newline, are ignored)
   -v FILENUM        like -a FILENUM, but suppress joined output lines
   -o1 FIELDS        output these fields from file 1 (FIELDS is a
                       comma-separated list of field)
   -o2 FIELDS        output these fields from file 2
+  -oN FIELDS        output these fields from file N (for any N)
+  -O FILE           write the output to FILE instead of standard output
+  -p N PATTERN      write the output to N files instead of standard output,
+                      selected by a hash of the join key, so that all lines
+                      with the same key are in the same file; file names
+                      are given by PATTERN, with %d replaced by the number
+                      of the file (from 0), e.g. -p 16 'out-%d.txt'; the
+                      header (with -H) is written to all files; with -W,
+                      each file is written by a separate thread (not
+                      supported for range joins)
+  -UN FILE          write unpaired lines from file N to FILE (for any N), in
+                      the same pass as the main output (which then contains
+                      unpaired lines only if -a N or -v N is given as well);
+                      e.g. -O out.txt -U1 only1.txt -U2 only2.txt writes
+                      the joined lines and the unpaired lines from both
+                      files to three separate files
+  -PN FIELDS        output these fields from file N to the file given by
+                      -UN (default: all fields)
+  -B DIST           band join: pair lines where the join fields differ by at
+                      most DIST (instead of being identical); lines from
+                      FILE1 within DIST of each line in FILE2 are kept in
+                      memory and output follows the order of FILE2 (only for
+                      two files and a single numeric or time join field;
+                      with -k time, DIST is given in seconds)
+  -I FIELD          interval join: lines in FILE1 are intervals starting at
+                      its join field and ending at FIELD (inclusive), lines
+                      in FILE2 are paired with all intervals that contain
+                      their join field; FILE1 needs to be sorted by the
+                      start of the intervals; output follows the order of
+                      FILE2 (with the same restrictions as -B)
+  -A DIR[:TOL]      as-of join: pair each line in FILE2 with one line from
+                      FILE1: the last one with a join field not larger than
+                      it if DIR is backward, the first one with a join field
+                      not smaller if DIR is forward or the closer of these
+                      if DIR is nearest; if TOL is given, only lines with join
+                      fields differing by at most TOL are paired (with the
+                      same restrictions as -B)
   -c                check that the input is correctly sorted, even
                       if all input lines are pairable
   -H                treat the first line in both files as field headers,
                       print them without trying to pair them
+  -m MEM            keep at most MEM megabytes of lines with the same join
+                      field from each file in memory (default: 256); larger
+                      groups are processed in blocks, lines from FILE2 that
+                      do not fit are written to a temporary file
+  -S                sort the input files on the join fields before joining
+                      them: blocks of at most MEM megabytes (see -m) are
+                      sorted and written to temporary files (in $TMPDIR,
+                      deleted automatically), which are then merged while
+                      joining
+  -W                write the output in a separate thread, so that joining
+                      can continue while output is written to a slow
+                      destination (e.g. a pipe to a compression program);
+                      statistics about waiting for the writer thread are
+                      written to stderr
+  -Z METHOD[:LEVEL] compress the output with METHOD (gzip or zstd, the
+                      latter only if compiled with zstd support), using
+                      the given compression LEVEL; blocks of the output are
+                      compressed in parallel using all available CPU cores,
+                      the result is a single valid compressed stream
+  -f FORMAT         format of the output: tsv (text, default), arrow (Apache
+                      Arrow IPC stream, can be read e.g. with
+                      pyarrow.ipc.open_stream()) or bin (see below); with
+                      arrow, the output fields have to be given with -oN for
+                      all files or a header with -H (columns are named by the
+                      header or as fileN_FIELD); join fields are written with
+                      the type given by -k (other fields as strings), values
+                      that cannot be converted and the fields of missing lines
+                      are nulls; files given by -UN are still text (not
+                      supported with -p); with bin, the output is in the
+                      binary table format of tsv2bin, which is read directly
+                      by numjoin and hashjoin (also from standard input), so
+                      that joins can be chained with pipes without writing and
+                      splitting text lines again
+                      (e.g. numjoin -f bin A B | numjoin - C); its fields are
+                      separated by -t CHAR when read back (not supported
+                      with -p)
   -h                display this help and exit
 
 Unless -t CHAR is given, leading blanks separate fields and are ignored,
 else fields are separated by CHAR.  Any FIELD is a field number counted
 from 1.
 
-Important: FILE1 and FILE2 must be sorted on the join fields.
-  (use sort -n or similar to achieve this)
+Important: all input files must be sorted on the join fields.
+  (use sort -n or similar to achieve this, or give -S)
 
 )!!!";
 
+/* maximum number of fields in a composite join key */
+static const size_t max_key_fields = 4;
+
 /*
- * reads one line from the given stream and splits it according to the
- * 	given separator, stores string parts in res
- * if field > 0 tries to parse the text in that field as an ID
- * 
- * returns true on success, false on errors
+ * join key consisting of several fields, compared lexicographically
+ * (unused fields are left as zero, so they always compare equal)
+ */
+template<class T> struct key_tuple {
+	T k[max_key_fields];
+	unsigned int n; /* number of fields used (only for display) */
+	key_tuple():n(0) { for(size_t i=0;i<max_key_fields;i++) k[i] = T(); }
+	bool operator < (const key_tuple& t) const {
+		for(size_t i=0;i<max_key_fields;i++) if(k[i] != t.k[i]) return k[i] < t.k[i];
+		return false;
+	}
+	bool operator == (const key_tuple& t) const {
+		for(size_t i=0;i<max_key_fields;i++) if(k[i] != t.k[i]) return false;
+		return true;
+	}
+	bool operator != (const key_tuple& t) const { return !(*this == t); }
+};
+template<class T>
+std::ostream& operator << (std::ostream& s, const key_tuple<T>& t) {
+	for(unsigned int i=0;i<t.n;i++) {
+		if(i) s<<',';
+		s<<t.k[i];
+	}
+	return s;
+}
+
+/* fixed point decimal number, stored as an integer multiplied by 10^digits */
+struct fixed_point {
+	int64_t v;
+	unsigned int digits; /* number of digits after the decimal point (only for display) */
+	fixed_point():v(0),digits(0) { }
+	bool operator < (const fixed_point& x) const { return v < x.v; }
+	bool operator == (const fixed_point& x) const { return v == x.v; }
+	bool operator != (const fixed_point& x) const { return v != x.v; }
+};
+std::ostream& operator << (std::ostream& s, const fixed_point& x) {
+	uint64_t scale = 1;
+	for(unsigned int i=0;i<x.digits;i++) scale *= 10;
+	uint64_t a = x.v < 0 ? -(uint64_t)x.v : (uint64_t)x.v;
+	if(x.v < 0) s<<'-';
+	s<<(a / scale);
+	if(x.digits) {
+		std::string frac = std::to_string(a % scale);
+		s<<'.'<<std::string(x.digits - frac.size(),'0')<<frac;
+	}
+	return s;
+}
+
+/* timestamp, stored as nanoseconds since the epoch */
+struct timestamp {
+	int64_t ns;
+	timestamp():ns(0) { }
+	bool operator < (const timestamp& x) const { return ns < x.ns; }
+	bool operator == (const timestamp& x) const { return ns == x.ns; }
+	bool operator != (const timestamp& x) const { return ns != x.ns; }
+};
+/* write a timestamp in ISO-8601 format (UTC) */
+std::ostream& operator << (std::ostream& s, const timestamp& x) {
+	int64_t sec = x.ns / 1000000000LL;
+	int64_t frac = x.ns % 1000000000LL;
+	if(frac < 0) { frac += 1000000000LL; sec--; }
+	int64_t days = sec / 86400;
+	int64_t rem = sec % 86400;
+	if(rem < 0) { rem += 86400; days--; }
+	/* convert days to date (inverse of read_table_days_from_civil()) */
+	days += 719468;
+	const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	const unsigned int doe = (unsigned int)(days - era * 146097);
+	const unsigned int yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+	const unsigned int doy = doe - (365*yoe + yoe/4 - yoe/100);
+	const unsigned int mp = (5*doy + 2)/153;
+	const unsigned int d = doy - (153*mp+2)/5 + 1;
+	const unsigned int m = mp < 10 ? mp+3 : mp-9;
+	const int64_t y = (int64_t)yoe + era * 400 + (m <= 2);
+	char buf[64];
+	snprintf(buf,64,"%04lld-%02u-%02uT%02u:%02u:%02u.%09lldZ",(long long)y,m,d,
+		(unsigned int)(rem/3600),(unsigned int)(rem/60%60),(unsigned int)(rem%60),(long long)frac);
+	return s<<buf;
+}
+
+/*
+ * string join key, compared byte by byte (i.e. in the same order as with
+ * LC_ALL=C sort); when parsed, it refers to the field in the current line
+ * without copying it; a copy is only made when assigned to another key
+ * (e.g. to keep the current ID while the next line is read)
+ * the first 8 bytes are stored as an integer, so most comparisons do not
+ * need to access the string itself
  */
-static bool SplitLine(line_parser& sr, std::vector<std::pair<size_t,size_t> >& res) {
-	for(size_t i=0;i<res.size();i++) if(!sr.read_string_view_pair(res[i])) return false;
+struct string_key {
+	uint64_t prefix; /* first 8 bytes in big endian order, padded with zeros */
+	const char* str;
+	size_t len;
+	std::string copy; /* storage used if this is a copy */
+	string_key():prefix(0),str(""),len(0) { }
+	string_key(const string_key& k):prefix(k.prefix),copy(k.str,k.len) { str = copy.data(); len = k.len; }
+	string_key& operator = (const string_key& k) {
+		if(this != &k) {
+			prefix = k.prefix;
+			copy.assign(k.str,k.len); /* note: reuses the already allocated memory */
+			str = copy.data();
+			len = k.len;
+		}
+		return *this;
+	}
+	/* set to refer to the given string (without copying) */
+	void set_view(const char* s, size_t l) {
+		str = s;
+		len = l;
+		prefix = 0;
+		for(size_t i=0;i<8 && i<l;i++) prefix |= ((uint64_t)(unsigned char)s[i]) << (56 - 8*i);
+	}
+	int compare(const string_key& k) const {
+		if(prefix != k.prefix) return prefix < k.prefix ? -1 : 1;
+		/* the first 8 bytes (or all of the shorter string) are the same */
+		size_t l = len < k.len ? len : k.len;
+		if(l > 8) {
+			int r = memcmp(str + 8,k.str + 8,l - 8);
+			if(r) return r;
+		}
+		return len < k.len ? -1 : (len > k.len ? 1 : 0);
+	}
+	bool operator < (const string_key& k) const { return compare(k) < 0; }
+	bool operator == (const string_key& k) const {
+		return len == k.len && prefix == k.prefix && (len <= 8 || !memcmp(str + 8,k.str + 8,len - 8));
+	}
+	bool operator != (const string_key& k) const { return !(*this == k); }
+};
+std::ostream& operator << (std::ostream& s, const string_key& k) {
+	s.write(k.str,k.len);
+	return s;
+}
+
+/* description of the join key in one file */
+struct key_spec {
+	std::vector<int> fields; /* fields making up the key, in the order they are compared */
+	std::vector<size_t> order; /* indices into fields, sorted by the field numbers */
+	unsigned int digits; /* number of decimal digits for fixed point keys */
+	key_spec():digits(0) { }
+	explicit key_spec(int field):fields(1,field),order(1,0),digits(0) { }
+	/* set fields from a comma-separated list (see ParseFieldList());
+	 * returns false if invalid */
+	bool set_fields(const char* list, std::vector<std::string>& names) {
+		if(!ParseFieldList(list,fields,names) || fields.size() > max_key_fields) return false;
+		for(size_t i=0;i<fields.size();i++)
+			for(size_t j=0;j<i;j++) if(fields[i] == fields[j]) return false;
+		set_order();
+		return true;
+	}
+	/* sort the fields by their number (needs to be called if fields are changed) */
+	void set_order() {
+		order.clear();
+		for(size_t i=0;i<fields.size();i++) order.push_back(i);
+		std::sort(order.begin(),order.end(),[this](size_t i, size_t j) { return fields[i] < fields[j]; });
+	}
+};
+
+/* parse one field of the join key; overloaded for all key types */
+static bool ParseKey(line_parser& sr, const key_spec&, int64_t& id) { return sr.read_int64(id); }
+static bool ParseKey(line_parser& sr, const key_spec&, uint64_t& id) { return sr.read_uint64(id); }
+static bool ParseKey(line_parser& sr, const key_spec&, double& id) {
+	/* note: NaN is not accepted, as it cannot be ordered */
+	return sr.read_double_limits(id,-HUGE_VAL,HUGE_VAL);
+}
+static bool ParseKey(line_parser& sr, const key_spec& ks, fixed_point& id) {
+	id.digits = ks.digits;
+	return sr.read_fixed_point(id.v,ks.digits);
+}
+static bool ParseKey(line_parser& sr, const key_spec&, timestamp& id) { return sr.read_timestamp(id.ns); }
+static bool ParseKey(line_parser& sr, const key_spec&, string_key& id) {
+	std::pair<size_t,size_t> pos;
+	if(!sr.read_string_view_pair(pos)) return false;
+	id.set_view(sr.get_line_c_str() + pos.first,pos.second);
 	return true;
 }
 
-/* get the numeric ID from the current line and field */
-static bool GetID(line_parser& sr, int field, int64_t& id) {
+/* get the ID from the current line and field */
+template<class K>
+static bool GetID(line_parser& sr, const key_spec& ks, K& id) {
+	int field = ks.fields[0];
 	if(field < 1) return false;
 	size_t j = (size_t)(field-1);
 	for(size_t i=0;i<j;i++) sr.read_skip();
-	return sr.read_int64(id);
+	return ParseKey(sr,ks,id);
+}
+/* same for composite keys: fields are read in the order they appear in the line */
+template<class T>
+static bool GetID(line_parser& sr, const key_spec& ks, key_tuple<T>& id) {
+	int col = 1;
+	for(size_t i : ks.order) {
+		for(;col<ks.fields[i];col++) sr.read_skip();
+		if(!ParseKey(sr,ks,id.k[i])) return false;
+		col++;
+	}
+	id.n = ks.fields.size();
+	return true;
+}
+
+/* hash of a join key, used to select the partition of output lines (-p);
+ * keys that compare equal have the same hash; string keys are hashed the
+ * same way as in hashjoin */
+static uint64_t KeyHash(int64_t x) { return partitioned_output::hash(&x,sizeof(x)); }
+static uint64_t KeyHash(uint64_t x) { return partitioned_output::hash(&x,sizeof(x)); }
+static uint64_t KeyHash(double x) {
+	if(x == 0.0) x = 0.0; /* -0.0 == 0.0 */
+	return partitioned_output::hash(&x,sizeof(x));
+}
+static uint64_t KeyHash(const fixed_point& x) { return KeyHash(x.v); }
+static uint64_t KeyHash(const timestamp& x) { return KeyHash(x.ns); }
+static uint64_t KeyHash(const string_key& x) { return partitioned_output::hash(x.str,x.len); }
+template<class T>
+static uint64_t KeyHash(const key_tuple<T>& t) {
+	uint64_t h[max_key_fields];
+	for(size_t i=0;i<max_key_fields;i++) h[i] = KeyHash(t.k[i]);
+	return partitioned_output::hash(h,sizeof(h));
 }
 
 struct parsed_line {
 	line_parser parser;
 	std::vector<std::pair<size_t,size_t> > fields;
+	size_t max_fields; /* split at most this many fields (e.g. if the whole line is output as-is) */
 	parsed_line() = delete;
 	parsed_line(const parsed_line& pl) = delete;
 	parsed_line(parsed_line&& pl) = default;
-	parsed_line(line_parser_params par, const std::string& line, size_t req_fields):parser(par,line) {
+	parsed_line(line_parser_params par, const std::string& line, size_t req_fields, size_t max_fields_ = SIZE_MAX):
+			parser(par,line),max_fields(max_fields_) {
 		fields.reserve(req_fields);
+		split();
+	}
+	/* replace the stored line with a new one and split it */
+	void set_line(const std::string& line) {
+		parser.set_line(line);
+		fields.clear();
+		split();
+	}
+	const std::string& get_line_str() const { return parser.get_line_str(); }
+	/* approximate memory used by this line */
+	size_t mem_size() const {
+		return sizeof(parsed_line) + parser.get_line_str().capacity() +
+			fields.capacity()*sizeof(std::pair<size_t,size_t>);
+	}
+	protected:
+		void split() {
+			while(fields.size() < max_fields) {
+				std::pair<size_t,size_t> v;
+				if(!parser.read_string_view_pair(v)) break;
+				fields.push_back(v);
+			}
+		}
+};
+
+/* create a temporary file in $TMPDIR (or /tmp), which is deleted right
+ * away (it is kept until closed); returns its file descriptor or -1 */
+static int CreateTempFile() {
+	const char* dir = getenv("TMPDIR");
+	if(!dir || !dir[0]) dir = "/tmp";
+	std::string fn = std::string(dir) + "/numjoin-XXXXXX";
+	int fd = mkstemp(&fn[0]);
+	if(fd >= 0) unlink(fn.c_str());
+	return fd;
+}
+
+/*
+ * temporary file to store lines from a group of lines with the same ID
+ * that do not fit in memory; lines are written after each other and can
+ * be read back any number of times (after calling rewind())
+ * the file is reused for later groups after calling reset()
+ */
+struct spill_file {
+	FILE* f;
+	uint64_t lines; /* number of lines stored */
+	uint64_t read_lines; /* number of lines read back since last rewind() */
+	spill_file():f(0),lines(0),read_lines(0) { }
+	~spill_file() { if(f) fclose(f); }
+	spill_file(const spill_file&) = delete;
+	spill_file& operator = (const spill_file&) = delete;
+	spill_file(spill_file&& sf):f(sf.f),lines(sf.lines),read_lines(sf.read_lines) { sf.f = 0; }
+	/* discard all stored lines */
+	bool reset() {
+		lines = 0;
+		read_lines = 0;
+		if(!f) {
+			int fd = CreateTempFile();
+			if(fd < 0) return false;
+			f = fdopen(fd,"w+");
+			if(!f) { close(fd); return false; }
+		}
+		::rewind(f);
+		return true;
+	}
+	/* add one line to the end of the file (after reset() or previously
+	 * added lines -- note: it is an error to mix reading and writing) */
+	bool write(const std::string& line) {
+		size_t len = line.size();
+		if(fwrite(&len,sizeof(size_t),1,f) != 1) return false;
+		if(len && fwrite(line.data(),1,len,f) != len) return false;
+		lines++;
+		return true;
+	}
+	/* start reading lines from the beginning */
+	bool rewind() {
+		read_lines = 0;
+		if(fflush(f)) return false;
+		::rewind(f);
+		return true;
+	}
+	/* read back the next line; returns false at the end or on error */
+	bool read(std::string& line) {
+		if(read_lines == lines) return false;
+		size_t len;
+		if(fread(&len,sizeof(size_t),1,f) != 1) return false;
+		line.resize(len);
+		if(len && fread(&line[0],1,len,f) != len) return false;
+		read_lines++;
+		return true;
+	}
+};
+
+
+/*
+ * one input file read in a background thread: lines are read in blocks
+ * and the ID is parsed from each line; the consumer works on one block while
+ * the next one is filled
+ */
+template<class K>
+struct shard_reader {
+	/* one block of lines */
+	struct block {
+		std::vector<std::string> lines;
+		std::vector<K> ids;
+		std::vector<uint64_t> line_nums; /* line number of each line in the file */
+		size_t n; /* number of lines in this block (lines.size() can be larger) */
+		enum read_table_errors err; /* error after the lines in the block (or T_OK) */
+		std::string err_msg; /* formatted error message if err is not T_EOF */
+		block():n(0),err(T_OK) { }
+	};
+	static const size_t block_size = 65536; /* approximate size of one block in bytes */
+	
+	read_table2 sr;
+	const char* fn;
+	const key_spec& ks;
+	std::string header_line; /* first line if the file has a header */
+	bool have_header;
+	
+	block blocks[2];
+	block* free_block; /* block that can be filled by the reader thread (or NULL) */
+	block* ready_block; /* block filled by the reader thread (or NULL) */
+	block* cur; /* block used by the consumer */
+	size_t pos; /* position in cur */
+	bool stop;
+	std::mutex m;
+	std::condition_variable cv;
+	std::thread th;
+	
+	shard_reader(const char* fn_, const key_spec& ks_, line_parser_params par, bool header):sr(fn_,par),fn(fn_),
+			ks(ks_),have_header(false),free_block(blocks + 1),ready_block(0),cur(blocks),pos(0),stop(false) {
+		/* the header is read before any line is parsed for its ID */
+		if(header) {
+			if(!sr.read_line()) {
+				set_error(*cur);
+				return;
+			}
+			header_line = sr.get_line_str();
+			have_header = true;
+		}
+		/* the first block is filled here, the thread is started after */
+		fill(*cur);
+		if(cur->err == T_OK) th = std::thread(&shard_reader::run,this);
+	}
+	~shard_reader() {
+		if(th.joinable()) {
+			{
+				std::unique_lock<std::mutex> lock(m);
+				stop = true;
+			}
+			cv.notify_all();
+			th.join();
+		}
+	}
+	
+	/* store the last error of sr in b */
+	void set_error(block& b) {
+		b.err = sr.get_last_error();
+		if(b.err != T_EOF) {
+			std::ostringstream str;
+			sr.write_error(str);
+			b.err_msg = str.str();
+		}
+	}
+	
+	/* read lines into b; stops after block_size bytes or on error or EOF */
+	void fill(block& b) {
+		b.n = 0;
+		size_t bytes = 0;
+		while(bytes < block_size) {
+			K id;
+			if(! (sr.read_line() && GetID(sr,ks,id)) ) {
+				set_error(b);
+				return;
+			}
+			if(b.n == b.lines.size()) {
+				b.lines.emplace_back();
+				b.ids.emplace_back();
+				b.line_nums.push_back(0);
+			}
+			b.lines[b.n] = sr.get_line_str();
+			b.ids[b.n] = id;
+			b.line_nums[b.n] = sr.get_line();
+			bytes += b.lines[b.n].size() + 1;
+			b.n++;
+		}
+	}
+	
+	/* main function of the reader thread */
+	void run() {
 		while(true) {
-			std::pair<size_t,size_t> v;
-			if(!parser.read_string_view_pair(v)) break;
-			fields.push_back(v);
+			block* b;
+			{
+				std::unique_lock<std::mutex> lock(m);
+				while(!(free_block || stop)) cv.wait(lock);
+				if(stop) return;
+				b = free_block;
+				free_block = 0;
+			}
+			fill(*b);
+			{
+				std::unique_lock<std::mutex> lock(m);
+				ready_block = b;
+			}
+			cv.notify_all();
+			if(b->err != T_OK) return;
 		}
 	}
-	const std::string& get_line_str() const { return parser.get_line_str(); }
+	
+	/* true if there is a current line */
+	bool valid() const { return pos < cur->n; }
+	const K& id() const { return cur->ids[pos]; }
+	const std::string& line_str() const { return cur->lines[pos]; }
+	uint64_t line_num() const { return cur->line_nums[pos]; }
+	/* error at the end of this file (if valid() is false) */
+	enum read_table_errors error() const { return cur->err; }
+	
+	/* advance to the next line; valid() should be checked after */
+	void advance() {
+		pos++;
+		if(pos < cur->n || cur->err != T_OK) return;
+		/* switch to the next block filled by the reader thread */
+		std::unique_lock<std::mutex> lock(m);
+		free_block = cur;
+		cv.notify_all();
+		while(!ready_block) cv.wait(lock);
+		cur = ready_block;
+		ready_block = 0;
+		pos = 0;
+	}
+};
+
+/*
+ * one input of the join: either one file, or several files (shards) each
+ * sorted by the join field that are merged while reading
+ * 
+ * shards are read in background threads and merged with a loser tree
+ */
+template<class K>
+struct sorted_input {
+	protected:
+		std::vector<std::string> fns; /* file names */
+		std::unique_ptr<read_table2> rt; /* input if there is only one file */
+		std::vector<std::unique_ptr<shard_reader<K> > > shards; /* inputs if there are more */
+		std::vector<size_t> tree; /* loser tree on shards, tree[0] is the current one */
+		key_spec ks;
+		line_parser_params par;
+		size_t max_fields; /* number of fields to split in lines that are stored */
+		enum read_table_errors last_error;
+		size_t err_shard; /* shard that failed before the merge is started */
+		bool started;
+		
+		/* true if shard a should come before shard b */
+		bool before(size_t a, size_t b) const {
+			if(!shards[a]->valid()) return false;
+			if(!shards[b]->valid()) return true;
+			if(shards[a]->id() != shards[b]->id()) return shards[a]->id() < shards[b]->id();
+			return a < b;
+		}
+		
+		void build_tree() {
+			size_t k = shards.size();
+			std::vector<size_t> win(2*k);
+			tree.resize(k);
+			for(size_t i=0;i<k;i++) win[k+i] = i;
+			for(size_t n=k-1;n>0;n--) {
+				size_t l = win[2*n];
+				size_t r = win[2*n+1];
+				if(before(r,l)) std::swap(l,r);
+				win[n] = l;
+				tree[n] = r;
+			}
+			tree[0] = win[1];
+		}
+		
+		void replay(size_t w) {
+			size_t k = shards.size();
+			for(size_t n=(w+k)/2;n>0;n/=2) if(before(tree[n],w)) std::swap(tree[n],w);
+			tree[0] = w;
+		}
+		
+		/* set last_error based on the current shard */
+		bool check_current() {
+			const shard_reader<K>& s = *shards[tree[0]];
+			if(s.valid()) { last_error = T_OK; return true; }
+			last_error = s.error();
+			/* note: the current shard has no more lines, but others
+			 * might still have (if it ended with an error) */
+			return false;
+		}
+		
+	public:
+		/* create from a list of file names; "-" means stdin (only allowed if
+		 * it is the only file) */
+		sorted_input(std::vector<std::string>&& fns_, const key_spec& ks_, line_parser_params par_, bool header):
+				fns(std::move(fns_)),ks(ks_),par(par_),max_fields(SIZE_MAX),last_error(T_OK),err_shard(0),started(false) {
+			if(fns.size() == 1) rt.reset(new read_table2(fns[0] == "-" ? 0 : fns[0].c_str(),std::cin,par));
+			else for(const std::string& fn : fns) shards.emplace_back(new shard_reader<K>(fn.c_str(),ks,par,header));
+		}
+		sorted_input(sorted_input&& in) = default;
+		
+		/* read the header line of the input (from all files if there are
+		 * more) and store the one from the first file in header */
+		bool read_header(std::string& header) {
+			if(rt) {
+				if(!rt->read_line()) return false;
+				header = rt->get_line_str();
+				return true;
+			}
+			for(size_t i=0;i<shards.size();i++) {
+				const shard_reader<K>& s = *shards[i];
+				if(!s.have_header) { last_error = s.error(); err_shard = i; return false; }
+			}
+			header = shards[0]->header_line;
+			return true;
+		}
+		
+		/* read the next line and parse the ID from it */
+		bool next(K& id) {
+			if(rt) return rt->read_line() && GetID(*rt,ks,id);
+			if(!started) {
+				build_tree();
+				started = true;
+			}
+			else {
+				size_t w = tree[0];
+				if(!shards[w]->valid()) return false;
+				shards[w]->advance();
+				if(!shards[w]->valid() && shards[w]->error() != T_EOF) {
+					/* stop on errors */
+					last_error = shards[w]->error();
+					return false;
+				}
+				replay(w);
+			}
+			if(!check_current()) return false;
+			id = shards[tree[0]]->id();
+			return true;
+		}
+		
+		const std::string& get_line_str() const {
+			if(rt) return rt->get_line_str();
+			return shards[tree[0]]->line_str();
+		}
+		line_parser_params get_params() const { return par; }
+		size_t get_max_fields() const { return max_fields; }
+		void set_max_fields(size_t n) { max_fields = n; }
+		enum read_table_errors get_last_error() const {
+			if(rt) return rt->get_last_error();
+			return last_error;
+		}
+		/* file name of the current line (or NULL for stdin) */
+		const char* get_fn() const {
+			if(rt) return rt->get_fn();
+			return shards[tree.size() ? tree[0] : err_shard]->fn;
+		}
+		/* line number of the current line in its file */
+		uint64_t get_line() const {
+			if(rt) return rt->get_line();
+			if(tree.empty() || !shards[tree[0]]->valid()) return 0;
+			return shards[tree[0]]->line_num();
+		}
+		void write_error(std::ostream& f) const {
+			if(rt) { rt->write_error(f); return; }
+			const shard_reader<K>& s = *shards[tree.size() ? tree[0] : err_shard];
+			if(s.error() != T_EOF && !s.valid()) f<<s.cur->err_msg;
+			else f<<"read_table, file "<<get_fn()<<": "<<get_error_desc(last_error)<<"\n";
+		}
 };
 
+/*
+ * expand one input argument to a list of files: if it contains wildcards
+ * it is expanded with glob(), if it starts with @, it is a file containing
+ * a list of file names (one per line); otherwise, it is used as-is
+ */
+static bool ExpandInput(const char* arg, std::vector<std::string>& fns) {
+	fns.clear();
+	if(arg[0] == '@') {
+		std::ifstream f(arg + 1);
+		if(!f) { std::cerr<<"Error opening list of input files "<<(arg+1)<<"!\n"; return false; }
+		std::string line;
+		while(std::getline(f,line)) if(line.size()) fns.push_back(line);
+		if(fns.empty()) { std::cerr<<"No input files listed in "<<(arg+1)<<"!\n"; return false; }
+	}
+	else if(strpbrk(arg,"*?[")) {
+		glob_t g;
+		if(glob(arg,0,0,&g)) { std::cerr<<"No input files found matching "<<arg<<"!\n"; return false; }
+		for(size_t i=0;i<g.gl_pathc;i++) fns.push_back(g.gl_pathv[i]);
+		globfree(&g);
+	}
+	else fns.push_back(arg);
+	return true;
+}
 
-static void write_split_error(const read_table2& rt, const line_parser& lp, size_t i) {
+template<class K>
+static void write_split_error(const sorted_input<K>& rt, const line_parser& lp, size_t i) {
 	const char* fn = rt.get_fn();
 	size_t real_line = rt.get_line() - i;
 	std::cerr<<"Error parsing data in file ";
@@ -142,230 +872,1046 @@ static void write_split_error(const read_table2& rt, const line_parser& lp, size
  * input: 
  * 	 sr -- stream to read
  *   nextid -- next id in the stream (if already read)
- *   field -- field containing the ID
  *   req_fields -- required number of fields in the file
  *   first -- true if the first data line in the file
+ *   max_mem -- maximum amount of memory to use for the lines read; at
+ *       least one line is always read
  * 
  * output:
  *   id -- current ID
  *   lines -- collection of one or more lines with the current ID,
  *       or empty list if the file is empty
  *   nextid -- next ID in the file (if exists, unchanged otherwise)
+ *   more -- set to true if reading stopped since max_mem was reached
+ *       and the next line still has the same ID; in this case, calling
+ *       this function again will return the next block of lines with the
+ *       same ID
  * 
  * returns true on success or EOF, false on format error
  * note: returning true does not mean that there are any lines, lines.size() can be checked
  *   separately by the caller
  */
-static bool ReadNext(read_table2& sr, std::vector<parsed_line>& lines, int64_t& id,
-		int64_t& nextid, int field, size_t req_fields, bool first) {
+template<class K>
+static bool ReadNext(sorted_input<K>& sr, std::vector<parsed_line>& lines, K& id,
+		K& nextid, size_t req_fields, bool first, size_t max_mem, bool& more) {
 	lines.clear();
-	if(first) if(! (sr.read_line() && GetID(sr,field,nextid)) ) return sr.get_last_error() == T_EOF;
+	more = false;
+	if(first) if(! (sr.next(nextid)) ) return sr.get_last_error() == T_EOF;
 	if(sr.get_last_error() == T_EOF) return true;
 	id = nextid;
-	lines.emplace_back(line_parser_params().set_delim(sr.get_delim()).set_comment(sr.get_comment()),sr.get_line_str(),req_fields);
+	lines.emplace_back(sr.get_params(),sr.get_line_str(),req_fields,sr.get_max_fields());
 	if(lines.back().fields.size() < req_fields) {
 		write_split_error(sr,lines.back().parser,0);
 		return false;
 	}
+	size_t mem = lines.back().mem_size();
 	
 	// read further lines, until we have the same ID in them
 	while(true) {
-		if(! (sr.read_line() && GetID(sr,field,nextid)) ) {
+		if(! (sr.next(nextid)) ) {
 			if(sr.get_last_error() == T_EOF) return true;
 			else return false;
 		}
 		if(nextid != id) break;
-		lines.emplace_back(line_parser_params().set_delim(sr.get_delim()).set_comment(sr.get_comment()),sr.get_line_str(),req_fields);
+		if(mem >= max_mem) {
+			// the current line is kept in sr, it will be processed by the next call
+			more = true;
+			break;
+		}
+		lines.emplace_back(sr.get_params(),sr.get_line_str(),req_fields,sr.get_max_fields());
 		if(lines.back().fields.size() < req_fields) {
 			write_split_error(sr,lines.back().parser,0);
 			return false;
 		}
+		mem += lines.back().mem_size();
 	}
 	return true;
 }
 
-static inline void OutputField(std::ostream& sw, const std::string& buf, const std::pair<size_t,size_t>& pos) {
-	for(size_t i=0;i<pos.second;i++) sw<<buf[pos.first+i];
-}
-
-static void WriteFields(std::ostream& sw, const std::vector<std::pair<size_t,size_t> >& line,
-		const std::string& buf, const std::vector<int>& fields, bool& firstout, char out_sep) {
-	if(!fields.empty()) for(int f : fields) {
-		if(firstout) { if(!line.empty()) OutputField(sw,buf,line[f-1]); }
-		else {
-			if(!line.empty()) { sw<<out_sep; OutputField(sw,buf,line[f-1]); }
-			else sw<<out_sep;
+/*
+ * write all remaining lines with the current ID to a temporary file
+ * (to be called after ReadNext() returned with more == true)
+ * lines are still split to check that they have the required number of fields
+ * 
+ * returns true on success or EOF, false on format or I/O error
+ */
+template<class K>
+static bool SpillRest(sorted_input<K>& sr, spill_file& spill, const K& id, K& nextid,
+		size_t req_fields, parsed_line& tmp) {
+	while(true) {
+		tmp.set_line(sr.get_line_str());
+		if(tmp.fields.size() < req_fields) {
+			write_split_error(sr,tmp.parser,0);
+			return false;
+		}
+		if(!spill.write(sr.get_line_str())) {
+			std::cerr<<"Error writing temporary file!\n";
+			return false;
+		}
+		if(! (sr.next(nextid)) ) {
+			if(sr.get_last_error() == T_EOF) return true;
+			else return false;
 		}
-		firstout = false;
+		if(nextid != id) return true;
 	}
-	else for(const auto& s : line) {
-		if(firstout) OutputField(sw,buf,s);
-		else { sw<<out_sep; OutputField(sw,buf,s); }
-		firstout = false;
+}
+
+/* write out any buffered output; write an error message on failure
+ * and statistics about the writer thread if it was used */
+static bool FlushOutput(write_buffer& sw) {
+	bool ret = sw.finish();
+	if(!ret) std::cerr<<"Error writing output: "<<sw.get_error_str()<<"\n";
+	sw.write_stats(std::cerr);
+	return ret;
+}
+
+
+
+/*
+ * skip lines in sr until one with ID >= target is found
+ * (the current line in sr is expected to have nextid already parsed)
+ * 
+ * lines are not split, only the ID is parsed; sorted is set to false
+ * if lines are found to not be in increasing order
+ * returns true on success or EOF, false on format error
+ */
+template<class K>
+static bool SkipTo(sorted_input<K>& sr, const K& target, K& nextid, bool& sorted) {
+	sorted = true;
+	if(sr.get_last_error() == T_EOF) return true;
+	K previd;
+	while(nextid < target) {
+		previd = nextid;
+		if(! (sr.next(nextid)) ) return sr.get_last_error() == T_EOF;
+		if(nextid < previd) { sorted = false; return true; }
 	}
+	return true;
 }
 
 
-int main(int argc, char** args) {
-	const char* file1 = 0;
-	const char* file2 = 0;
-	
-	int field1 = 1;
-	int field2 = 1;
-	int req_fields1 = 1;
-	int req_fields2 = 1;
-	
-	std::vector<int> outfields1; bool outfields1_empty = false;
-	std::vector<int> outfields2; bool outfields2_empty = false;
-	
-	char delim = 0;
-	char comment = 0;
-	//~ const char* empty = 0;
+/* options given on the command line (indexed by file number - 1) */
+struct join_options {
+	std::vector<key_spec> keys; /* join fields */
+	std::vector<std::vector<int> > outfields; /* output fields (empty means all) */
+	std::vector<bool> outfields_empty; /* no fields written from a file */
+	std::vector<output_plan> plans; /* how to write the output fields of each file */
+	/* number of fields that need to be split in lines from file j (not all
+	 * if the whole line is written as-is) */
+	size_t split_fields(size_t j) const {
+		bool whole = plans[j].writes_whole_line();
+		if(unpaired_fns[j].size() && !unpaired_plans[j].writes_whole_line()) whole = false;
+		return whole ? req_fields[j] : SIZE_MAX;
+	}
+	std::vector<int> req_fields; /* number of fields required */
+	std::vector<bool> unpaired_files; /* write unpaired lines from a file */
+	std::string out_fn; /* write the output to this file instead of stdout (-O) */
+	/* separate output files for unpaired lines from each input (-UN; empty
+	 * if not used) and the fields written to them (-PN) */
+	std::vector<std::string> unpaired_fns;
+	std::vector<std::vector<int> > unpaired_fields;
+	std::vector<output_plan> unpaired_plans;
+	/* unpaired lines from file j are needed (in the output or a separate file) */
+	bool need_unpaired(size_t j) const { return unpaired_files[j] || unpaired_fns[j].size(); }
+	bool only_unpaired;
+	bool header;
+	bool strict_order;
+	size_t max_mem; /* memory limit for lines with the same ID (in bytes) */
+	char delim;
+	char comment;
+	char quote; /* fields can be quoted as in CSV files (-q) */
+	enum { RANGE_NONE, RANGE_BAND, RANGE_INTERVAL, RANGE_ASOF } range; /* type of range join */
+	std::string range_arg; /* parameter of the range join (e.g. distance) */
+	bool sort_input; /* sort input files before joining */
+	bool async_output; /* write output in a separate thread */
+	write_buffer::compression compress; /* compress the output */
+	int compress_level;
+	unsigned int partitions; /* split the output into this many files (-p) */
+	std::string partition_pattern;
+	std::vector<bool> json; /* input j is JSON Lines (-J) */
+	std::vector<std::vector<std::string> > json_keys; /* members extracted from it */
+	std::vector<std::vector<size_t> > widths; /* fixed-width fields in input j (-wN) */
+	std::vector<size_t> record_len; /* and its record length (if fixed) */
+	bool arrow; /* write the output in the Arrow IPC format (-f arrow) */
+	bool binary; /* write the output as a binary table (-f bin) */
+	arrow_writer::col_type arrow_key_type; /* type of the join fields in it */
+	join_options():only_unpaired(false),header(false),strict_order(false),
+		max_mem(256*1048576UL),delim(0),comment(0),quote(0),range(RANGE_NONE),sort_input(false),
+		async_output(false),compress(write_buffer::COMPRESS_NONE),compress_level(-1),partitions(0),
+		arrow(false),binary(false),arrow_key_type(arrow_writer::ARROW_INT64) { }
+	/* parameters for reading input j */
+	line_parser_params get_params(size_t j) const {
+		if(json[j]) return line_parser_params().set_delim('\t').set_json_keys(&json_keys[j]);
+		if(widths[j].size()) return line_parser_params().set_delim('\t').set_widths(&widths[j],record_len[j]);
+		return line_parser_params().set_delim(delim).set_comment(comment).set_quote(quote);
+	}
+	/* lines of input j are converted to tab-separated values when read */
+	bool converted(size_t j) const { return json[j] || widths[j].size(); }
+	/* set up writing the output to sw; write an error message on failure;
+	 * the available threads for compression are divided among nout outputs */
+	bool start_output(write_buffer& sw, unsigned int nout = 1) const {
+		if(compress != write_buffer::COMPRESS_NONE) {
+			unsigned int nthreads = std::thread::hardware_concurrency() / nout;
+			if(!sw.start_compress(compress,compress_level,nthreads)) {
+				std::cerr<<"Error setting up output compression\n";
+				return false;
+			}
+		}
+		else if(async_output && !sw.start_async(4))
+			std::cerr<<"Cannot start writer thread, writing output directly\n";
+		return true;
+	}
+};
+
+/*
+ * output of a join: the main output (stdout or the file given by -O, or
+ * split into partitions by the join key with -p) and the separate files
+ * for unpaired lines from each input (-UN), all written in the same pass
+ * with their own buffers; the main output is either text, in the Arrow
+ * format (with -f arrow) or a binary table (with -f bin)
+ */
+struct join_output {
+	const join_options& opt;
+	write_buffer sw; /* main output (if not partitioned) */
+	partitioned_output parts;
+	std::vector<std::unique_ptr<write_buffer> > unpaired_sw; /* NULL if not used */
+	std::vector<uint64_t> unpaired_lines; /* number of lines written to them */
+	std::unique_ptr<arrow_writer> arrow; /* NULL if writing text */
+	std::unique_ptr<binary_table_writer<write_buffer> > bin; /* NULL if not writing a binary table */
+	/* fields of each file written as columns (from 0) and the first column for each file */
+	std::vector<std::vector<size_t> > arrow_fields;
+	std::vector<size_t> arrow_first;
+	std::vector<const parsed_line*> sel; /* used when writing unpaired lines */
 	
-	int unpaired = 0; // if 1 or 2, print unpaired lines from the given file
-	bool only_unpaired = false;
-	bool header = false;
-	bool strict_order = false;
+	explicit join_output(const join_options& opt_):opt(opt_),sw(1),
+		unpaired_sw(opt.unpaired_fns.size()),unpaired_lines(opt.unpaired_fns.size(),0),
+		sel(opt.plans.size(),0) { }
 	
-	// process option arguments
-	int i=1;
-	for(;i<argc;i++) if(args[i][0] == '-' && args[i][1] != 0) switch(args[i][1]) {
-		case '1':
-			field1 = atoi(args[i+1]);
-			i++;
-			break;
-		case '2':
-			field2 = atoi(args[i+1]);
-			i++;
-			break;
-		case 'j':
-			field1 = atoi(args[i+1]);
-			field2 = field1;
-			i++;
-			break;
-		case 't':
-			delim = args[i+1][0];
-			i++;
-			break;
-		case 'C':
-			comment = args[i+1][0];
-			i++;
-			break;
-/*		case 'e':
-			empty = args[i+1];
-			i++;
-			break; */
-		case 'a':
-			unpaired = atoi(args[i+1]);
-			if( ! (unpaired == 1 || unpaired == 2) ) { std::cerr<<"-a parameter has to be either 1 or 2\n  use numjoin -h for help\n"; return 1; }
-			i++;
-			break;
-		case 'v':
-			unpaired = atoi(args[i+1]);
-			if( ! (unpaired == 1 || unpaired == 2) ) { std::cerr<<"-a parameter has to be either 1 or 2\n  use numjoin -h for help\n"; return 1; }
-			i++;
-			only_unpaired = true;
-			break;
-		case 'o':
-			if(!(args[i][2] == '1' || args[i][2] == '2')) { std::cerr<<"Invalid parameter: "<<args[i]<<"\n  (use -o1 or -o2)\n  use numjoin -h for help\n"; return 1; }
-			{
-				std::vector<int> tmp;
-				bool valid = true;
-				bool empty = true;
-				int max = 0;
-				// it is valid to give zero output columns from one of the files
-				// (e.g. to filter the other file)
-				// this case it might be necessary to give an empty string
-				// as the argument (i.e. -o1 "")
-				if( !(args[i+1] == 0 || args[i+1][0] == 0 || args[i+1][0] == '-') ) {
-					line_parser lp(line_parser_params().set_delim(','),args[i+1]);
-					int x;
-					while(lp.read(x)) { tmp.push_back(x); if(x > max) max = x; if(x < 1) { valid = false; break; } }
-					if(lp.get_last_error() != T_EOL || tmp.empty()) valid = false;
-					empty = false;
-				}
-				if(!valid) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
-				if(args[i][2] == '1') {
-					outfields1 = std::move(tmp);
-					if(max > req_fields1) req_fields1 = max;
-					outfields1_empty = empty;
-				}
-				if(args[i][2] == '2') {
-					outfields2 = std::move(tmp);
-					if(max > req_fields2) req_fields2 = max;
-					outfields2_empty = empty;
+	/* open all output files; write an error message on failure */
+	bool open() {
+		if(opt.partitions) {
+			if(!parts.init(opt.partitions,opt.partition_pattern)) {
+				std::cerr<<"Invalid output file name pattern: "<<opt.partition_pattern<<"\n";
+				return false;
+			}
+			for(size_t i=0;i<parts.size();i++) {
+				if(!parts.open(i)) {
+					std::cerr<<"Error opening output file "<<parts.fns[i]<<": "<<parts[i].get_error_str()<<"\n";
+					return false;
 				}
-				if(!(args[i+1] == 0 || args[i+1][0] == '-')) i++;
+				if(!opt.start_output(parts[i],parts.size())) return false;
 			}
-			break;
-		case 'H':
-			header = true;
-			break;
-		case 'c':
-			strict_order = true;
-			break;
-		case 'h':
-			std::cout<<usage;
-			return 0;
-		default:
-			std::cerr<<"Unknown parameter: "<<args[i]<<"\n  use numjoin -h for help\n";
-			return 1;
+		}
+		else {
+			if(opt.out_fn.size() && !sw.open_file(opt.out_fn.c_str())) {
+				std::cerr<<"Error opening output file "<<opt.out_fn<<": "<<sw.get_error_str()<<"\n";
+				return false;
+			}
+			if(!opt.start_output(sw)) return false;
+		}
+		for(size_t j=0;j<unpaired_sw.size();j++) if(opt.unpaired_fns[j].size()) {
+			unpaired_sw[j].reset(new write_buffer(1));
+			if(!unpaired_sw[j]->open_file(opt.unpaired_fns[j].c_str())) {
+				std::cerr<<"Error opening output file "<<opt.unpaired_fns[j]<<": "<<unpaired_sw[j]->get_error_str()<<"\n";
+				return false;
+			}
+			if(!opt.start_output(*unpaired_sw[j])) return false;
+		}
+		return true;
 	}
-	else break; // non-option argument, means the filenames
-	// i now points to the first filename
-	if(i + 1 >= argc) { std::cerr<<"Error: expecting two input filenames\n  use numjoin -h for help\n"; return 1; }
-	file1 = args[i];
-	file2 = args[i+1];
-	if(!strcmp(file1,file2)) { std::cerr<<"Error: input files have to be different!\n"; return 1; }
-	if(file1[0] == '-' && file1[1] == 0) file1 = 0;
-	if(file2[0] == '-' && file2[1] == 0) file2 = 0;
-	if(field1 < 1 || field2 < 1) { std::cerr<<"Error: field numbers have to be >= 1!\n"; return 1; }
-	
-	auto& sw = std::cout;
-	read_table2 s1(file1,std::cin,line_parser_params().set_delim(delim).set_comment(comment));
-	read_table2 s2(file2,std::cin,line_parser_params().set_delim(delim).set_comment(comment));
-	
-	int64_t id1 = INT64_MIN;
-	int64_t id2 = INT64_MIN;
-	
-	std::vector<parsed_line> lines1;
-	int64_t nextid1 = INT64_MIN;
-	std::vector<parsed_line> lines2;
-	int64_t nextid2 = INT64_MIN;
 	
-	char out_sep = '\t';
-	if(delim) out_sep = delim;
-	
-	std::vector<std::pair<size_t,size_t> > line1_fields(req_fields1);
-	std::vector<std::pair<size_t,size_t> > line2_fields(req_fields2);
+	/* main output for lines with the given join key */
+	template<class K>
+	write_buffer& get(const K& key) { return parts.size() ? parts.get(KeyHash(key)) : sw; }
+	/* call f for all main outputs (e.g. to write the header to each partition) */
+	template<class F>
+	void for_all(F f) {
+		if(parts.size()) for(size_t i=0;i<parts.size();i++) f(parts[i]);
+		else f(sw);
+	}
 	
-	if(header) {
-		// read and write output header
-		if( ! (s1.read_line() && SplitLine(s1,line1_fields) ) ) {
-			std::cerr<<"Error reading header in file 1:\n";
-			s1.write_error(std::cerr);
-			return 1;
+	/* write the header (headers contains the header line of each file, or
+	 * is NULL if there is no header) to the main outputs and the separate
+	 * files; with -f arrow, this sets up the columns and writes the schema */
+	void start(const parsed_line* const* headers) {
+		size_t n = opt.plans.size();
+		if(opt.binary) {
+			bin.reset(new binary_table_writer<write_buffer>(sw,opt.delim,headers != 0));
+			bin->start();
 		}
-		if( ! (s2.read_line() && SplitLine(s2,line2_fields) ) ) {
-			std::cerr<<"Error reading header in file 2:\n";
-			s2.write_error(std::cerr);
-			return 1;
+		if(!opt.arrow) {
+			if(!headers) return;
+			for_all([&](write_buffer& out) { write_line(out,headers); });
+			for(size_t j=0;j<n;j++) write_file(j,*headers[j]);
+			return;
 		}
-		
-			
-		bool firstout = true;
-		if(!outfields1_empty) WriteFields(sw,line1_fields,s1.get_line_str(),outfields1,firstout,out_sep);
-		if(!outfields2_empty) WriteFields(sw,line2_fields,s2.get_line_str(),outfields2,firstout,out_sep);
-		
+		arrow.reset(new arrow_writer(sw));
+		arrow_fields.resize(n);
+		arrow_first.resize(n);
+		for(size_t j=0;j<n;j++) {
+			std::vector<size_t>& fields = arrow_fields[j];
+			if(opt.outfields_empty[j]) fields.clear();
+			else if(opt.outfields[j].size()) for(int f : opt.outfields[j]) fields.push_back(f - 1);
+			else if(opt.json[j]) for(size_t i=0;i<opt.json_keys[j].size();i++) fields.push_back(i);
+			else if(opt.widths[j].size()) for(size_t i=0;i<opt.widths[j].size();i++) fields.push_back(i);
+			else for(size_t i=0;i<headers[j]->fields.size();i++) fields.push_back(i);
+			arrow_first[j] = arrow->columns();
+			for(size_t f : fields) {
+				std::string name;
+				if(headers && f < headers[j]->fields.size()) {
+					const std::pair<size_t,size_t>& x = headers[j]->fields[f];
+					name = headers[j]->get_line_str().substr(x.first,x.second);
+				}
+				else if(opt.json[j] && f < opt.json_keys[j].size()) name = opt.json_keys[j][f];
+				else name = "file" + std::to_string(j+1) + "_" + std::to_string(f+1);
+				bool key = false;
+				for(int k : opt.keys[j].fields) if((size_t)k == f + 1) key = true;
+				if(key) arrow->add_column(name,opt.arrow_key_type,opt.keys[j].digits);
+				else arrow->add_column(name,arrow_writer::ARROW_UTF8);
+			}
+			if(headers) write_file(j,*headers[j]);
+		}
+		arrow->start();
 	}
 	
-	// read first lines
-	if( !ReadNext(s1,lines1,id1,nextid1,field1,req_fields1,true) ) {
+	/* write one output line to out, made up of the lines in l (one for
+	 * each file, NULL for files that are missing) */
+	void write_line(write_buffer& out, const parsed_line* const* l) {
+		size_t n = opt.plans.size();
+		if(arrow) {
+			for(size_t j=0;j<n;j++) {
+				const std::vector<size_t>& fields = arrow_fields[j];
+				for(size_t i=0;i<fields.size();i++) {
+					size_t f = fields[i];
+					if(l[j] && f < l[j]->fields.size()) {
+						const std::pair<size_t,size_t>& x = l[j]->fields[f];
+						arrow->append(arrow_first[j] + i,l[j]->get_line_str().data() + x.first,x.second);
+					}
+					else arrow->append_null(arrow_first[j] + i);
+				}
+			}
+			arrow->end_row();
+			return;
+		}
+		if(bin) {
+			for(size_t j=0;j<n;j++) {
+				if(l[j]) opt.plans[j].append(*bin,l[j]->fields,l[j]->get_line_str());
+				else opt.plans[j].append_empty(*bin);
+			}
+			bin->end_row();
+			return;
+		}
+		bool firstout = true;
+		for(size_t j=0;j<n;j++) {
+			if(l[j]) opt.plans[j].write(out,l[j]->fields,l[j]->get_line_str(),firstout);
+			else opt.plans[j].write_empty(out,firstout);
+		}
+		out.put('\n');
+	}
+	
+	/* write a line from file j to its separate output file (if any) */
+	void write_file(size_t j, const parsed_line& l) {
+		if(!unpaired_sw[j]) return;
+		bool firstout = true;
+		opt.unpaired_plans[j].write(*unpaired_sw[j],l.fields,l.get_line_str(),firstout);
+		unpaired_sw[j]->put('\n');
+	}
+	/* write an unpaired line from file j to its separate output file (if any) */
+	void write_unpaired_file(size_t j, const parsed_line& l) {
+		if(!unpaired_sw[j]) return;
+		write_file(j,l);
+		unpaired_lines[j]++;
+	}
+	/* write an unpaired line from file j to its separate output file and
+	 * to the main output (out) if requested by -a or -v (with empty fields
+	 * for the other files); returns true if it was written to the main output */
+	bool write_unpaired(size_t j, const parsed_line& l, write_buffer& out) {
+		write_unpaired_file(j,l);
+		if(!opt.unpaired_files[j]) return false;
+		sel[j] = &l;
+		write_line(out,sel.data());
+		sel[j] = 0;
+		return true;
+	}
+	bool write_unpaired(size_t j, const parsed_line& l) { return write_unpaired(j,l,sw); }
+	
+	/* write out all buffered output and close the output files; write an
+	 * error message on failure and statistics about the separate files */
+	bool finish() {
+		if(arrow) {
+			arrow->finish();
+			std::cerr<<"Arrow record batches written: "<<arrow->get_batches()<<'\n';
+			if(arrow->get_invalid()) std::cerr<<"Invalid values written as nulls: "<<arrow->get_invalid()<<'\n';
+		}
+		if(bin) {
+			bin->finish();
+			std::cerr<<"Binary table groups written: "<<bin->get_groups()<<'\n';
+		}
+		bool ret = FlushOutput(sw);
+		for(size_t i=0;i<parts.size();i++) if(!parts[i].finish()) {
+			std::cerr<<"Error writing output file "<<parts.fns[i]<<": "<<parts[i].get_error_str()<<"\n";
+			ret = false;
+		}
+		for(size_t j=0;j<unpaired_sw.size();j++) if(unpaired_sw[j]) {
+			if(!unpaired_sw[j]->finish()) {
+				std::cerr<<"Error writing output file "<<opt.unpaired_fns[j]<<": "<<unpaired_sw[j]->get_error_str()<<"\n";
+				ret = false;
+			}
+			std::cerr<<"Unpaired lines from file "<<j+1<<" written to "<<opt.unpaired_fns[j]<<": "<<unpaired_lines[j]<<'\n';
+		}
+		return ret;
+	}
+};
+
+
+/* state of one input file when joining more than two files */
+template<class K>
+struct join_input {
+	sorted_input<K> sr;
+	int num; /* number of this file, counted from 1 */
+	size_t req_fields; /* number of fields required in each line */
+	bool unpaired; /* unpaired lines from this file should be written as well */
+	
+	std::vector<parsed_line> lines; /* current block of lines with the same ID */
+	K id; /* current ID */
+	K nextid; /* ID of the next line (already read in sr) */
+	bool more; /* there are more lines with the current ID not read yet */
+	spill_file spill; /* lines with the current ID that do not fit in memory */
+	bool spilled; /* spill is in use for the current ID */
+	parsed_line tmp; /* line read back from spill */
+	
+	uint64_t group; /* number of lines in the current group */
+	uint64_t max_group; /* largest group seen */
+	uint64_t matched; /* lines matched in all files */
+	uint64_t unmatched; /* unpaired lines written */
+	
+	join_input(std::vector<std::string>&& fns, int num_, const key_spec& ks, line_parser_params par, bool header):
+		sr(std::move(fns),ks,par,header),num(num_),req_fields(1),unpaired(false),
+		id(),nextid(),more(false),spilled(false),tmp(par,std::string(),0),
+		group(0),max_group(0),matched(0),unmatched(0) { }
+	
+	/* read the next block of lines, write an error message on failure */
+	bool read_next(bool first, size_t max_mem) {
+		if(!ReadNext(sr,lines,id,nextid,req_fields,first,max_mem,more)) {
+			std::cerr<<"Error reading data from file "<<num<<":\n";
+			sr.write_error(std::cerr);
+			return false;
+		}
+		group += lines.size();
+		return true;
+	}
+	/* check that the next line does not have a smaller ID than the current */
+	bool check_order() const {
+		if(sr.get_last_error() != T_EOF && nextid < id) {
+			const char* fn = sr.get_fn();
+			std::cerr<<"Error: input file "<<num<<" ("<<(fn?fn:"<stdin>");
+			std::cerr<<") not sorted on line "<<sr.get_line()<<" ( "<<nextid<<" < "<<id<<")!\n";
+			return false;
+		}
+		return true;
+	}
+	/* finish the current group: skip any remaining lines, update statistics
+	 * and read the first block of the next group */
+	bool advance(size_t max_mem) {
+		while(more) if(!read_next(false,max_mem)) return false;
+		if(group > max_group) max_group = group;
+		group = 0;
+		spilled = false;
+		lines.clear();
+		if(!check_order()) return false;
+		return read_next(false,max_mem);
+	}
+};
+
+/*
+ * sorting of unsorted input (-S): lines are read in blocks of at most
+ * max_mem bytes, each block is sorted and written to a temporary file
+ * (a "run"); the runs of each input are then merged while joining, in the
+ * same way as sets of sorted files given as input
+ */
+
+/*
+ * order-preserving conversion of keys to unsigned integers, so that they
+ * can be sorted with radix sort; only for keys with one numeric field,
+ * other key types are sorted by comparisons
+ */
+template<class K> struct radix_key {
+	static const bool use = false;
+	static uint64_t get(const K&) { return 0; }
+};
+template<> struct radix_key<uint64_t> {
+	static const bool use = true;
+	static uint64_t get(uint64_t x) { return x; }
+};
+template<> struct radix_key<int64_t> {
+	static const bool use = true;
+	static uint64_t get(int64_t x) { return ((uint64_t)x) ^ 0x8000000000000000ULL; }
+};
+template<> struct radix_key<double> {
+	static const bool use = true;
+	static uint64_t get(double x) {
+		uint64_t u;
+		memcpy(&u,&x,sizeof(uint64_t));
+		return (u & 0x8000000000000000ULL) ? ~u : (u | 0x8000000000000000ULL);
+	}
+};
+template<> struct radix_key<fixed_point> {
+	static const bool use = true;
+	static uint64_t get(const fixed_point& x) { return radix_key<int64_t>::get(x.v); }
+};
+template<> struct radix_key<timestamp> {
+	static const bool use = true;
+	static uint64_t get(const timestamp& x) { return radix_key<int64_t>::get(x.ns); }
+};
+
+/* one line to be sorted: its key and position in the buffer of lines */
+struct sort_entry {
+	uint64_t key;
+	size_t pos;
+	size_t len;
+};
+
+/* run f(i) for i = 0, ..., nthreads - 1, each in a separate thread */
+template<class F>
+static void ParallelFor(unsigned int nthreads, F f) {
+	std::vector<std::thread> threads;
+	for(unsigned int i=1;i<nthreads;i++) threads.emplace_back(f,i);
+	f(0);
+	for(std::thread& t : threads) t.join();
+}
+
+/*
+ * stable LSD radix sort of n entries in src on the lowest bytes of the key,
+ * using dst as temporary storage; the result is stored in dst
+ */
+static void LsdSort(sort_entry* src, sort_entry* dst, size_t n, unsigned int bytes) {
+	sort_entry* from = src;
+	sort_entry* to = dst;
+	for(unsigned int b=0;b<bytes;b++) {
+		size_t cnt[256] = {0};
+		unsigned int shift = 8*b;
+		for(size_t i=0;i<n;i++) cnt[(from[i].key >> shift) & 255]++;
+		if(cnt[(from[0].key >> shift) & 255] == n) continue; // all the same
+		size_t sum = 0;
+		for(size_t j=0;j<256;j++) { size_t c = cnt[j]; cnt[j] = sum; sum += c; }
+		for(size_t i=0;i<n;i++) to[cnt[(from[i].key >> shift) & 255]++] = from[i];
+		std::swap(from,to);
+	}
+	if(from != dst) std::copy(from,from+n,dst);
+}
+
+/*
+ * stable radix sort of entries, using nthreads threads: entries are first
+ * partitioned on the highest byte that is not the same in all keys (each
+ * thread processing a part of the input), then the resulting buckets are
+ * sorted on the remaining bytes in parallel
+ */
+static void RadixSort(std::vector<sort_entry>& v, std::vector<sort_entry>& tmp, unsigned int nthreads) {
+	size_t n = v.size();
+	if(n < 2) return;
+	uint64_t diff = 0;
+	for(const sort_entry& e : v) diff |= e.key ^ v[0].key;
+	if(!diff) return;
+	unsigned int hb = 7; // highest byte that differs
+	while(!(diff >> (8*hb))) hb--;
+	unsigned int shift = 8*hb;
+	tmp.resize(n);
+	
+	// partition on the highest byte
+	if(nthreads > n / 65536 + 1) nthreads = n / 65536 + 1;
+	size_t chunk = (n + nthreads - 1) / nthreads;
+	std::vector<size_t> cnt(256*nthreads,0);
+	ParallelFor(nthreads,[&](unsigned int t) {
+		size_t end = std::min(n,(t+1)*chunk);
+		for(size_t i=t*chunk;i<end;i++) cnt[256*t + ((v[i].key >> shift) & 255)]++;
+	});
+	std::vector<size_t> bucket(257);
+	size_t sum = 0;
+	for(size_t j=0;j<256;j++) {
+		bucket[j] = sum;
+		for(unsigned int t=0;t<nthreads;t++) { size_t c = cnt[256*t+j]; cnt[256*t+j] = sum; sum += c; }
+	}
+	bucket[256] = n;
+	ParallelFor(nthreads,[&](unsigned int t) {
+		size_t end = std::min(n,(t+1)*chunk);
+		size_t* off = cnt.data() + 256*t;
+		for(size_t i=t*chunk;i<end;i++) tmp[off[(v[i].key >> shift) & 255]++] = v[i];
+	});
+	
+	// sort each bucket on the lower bytes, with the result copied back to v
+	std::atomic<size_t> next(0);
+	ParallelFor(nthreads,[&](unsigned int) {
+		for(size_t j = next++; j < 256; j = next++) {
+			size_t s = bucket[j];
+			size_t len = bucket[j+1] - s;
+			if(len) LsdSort(tmp.data() + s,v.data() + s,len,hb);
+		}
+	});
+}
+
+/*
+ * temporary files: these are deleted right after they are created (so that
+ * they do not remain even if the program is terminated) and are accessed
+ * by the name /dev/fd/N while the file descriptor is kept open; they are
+ * closed when this object is destroyed
+ */
+struct temp_files {
+	std::vector<int> fds;
+	std::vector<std::string> names;
+	temp_files() = default;
+	temp_files(const temp_files&) = delete;
+	~temp_files() { for(int fd : fds) close(fd); }
+	/* create a new file and open it for writing; returns NULL on error */
+	FILE* create() {
+		int fd = CreateTempFile();
+		if(fd < 0) return 0;
+		fds.push_back(fd);
+		names.push_back("/dev/fd/" + std::to_string(fd));
+		int fd2 = dup(fd);
+		if(fd2 < 0) return 0;
+		FILE* f = fdopen(fd2,"w");
+		if(!f) close(fd2);
+		return f;
+	}
+	/* prepare the last file for reading (after the one returned by
+	 * create() was closed) */
+	bool rewind_last() { return lseek(fds.back(),0,SEEK_SET) == 0; }
+};
+
+/*
+ * sort the lines of one input (consisting of the files in fns, which are
+ * read after each other), in blocks of at most max_mem bytes; fns is
+ * replaced by the names of the sorted runs
+ */
+template<class K>
+static bool SortInput(std::vector<std::string>& fns, int num, const key_spec& ks, line_parser_params par,
+		bool header, size_t max_mem, unsigned int nthreads, temp_files& tmp) {
+	std::string data; /* lines in the current block */
+	std::vector<sort_entry> entries;
+	std::vector<sort_entry> scratch;
+	std::vector<K> keys; /* keys, if radix sort cannot be used */
+	std::vector<size_t> idx;
+	std::string header_line;
+	std::vector<std::string> runs;
+	uint64_t nlines = 0;
+	/* lines are written as read, fixed length records without newlines */
+	bool newline = !(par.widths && par.record_len);
+	
+	auto write_run = [&]() -> bool {
+		if(radix_key<K>::use) RadixSort(entries,scratch,nthreads);
+		else {
+			idx.resize(entries.size());
+			for(size_t i=0;i<idx.size();i++) idx[i] = i;
+			std::stable_sort(idx.begin(),idx.end(),[&keys](size_t i, size_t j) { return keys[i] < keys[j]; });
+		}
+		FILE* f = tmp.create();
+		if(!f) { std::cerr<<"Error creating temporary file!\n"; return false; }
+		runs.push_back(tmp.names.back());
+		bool ok = true;
+		if(header) ok = fwrite(header_line.data(),1,header_line.size(),f) == header_line.size() && (!newline || fputc('\n',f) != EOF);
+		for(size_t i=0;ok && i<entries.size();i++) {
+			const sort_entry& e = entries[radix_key<K>::use ? i : idx[i]];
+			ok = fwrite(data.data() + e.pos,1,e.len,f) == e.len && (!newline || fputc('\n',f) != EOF);
+		}
+		if(fclose(f)) ok = false;
+		if(!(ok && tmp.rewind_last())) { std::cerr<<"Error writing temporary file!\n"; return false; }
+		data.clear();
+		entries.clear();
+		keys.clear();
+		return true;
+	};
+	
+	bool have_header = false;
+	for(const std::string& fn : fns) {
+		read_table2 rt(fn == "-" ? 0 : fn.c_str(),std::cin,par);
+		if(header) {
+			if(rt.read_line()) {
+				if(!have_header) header_line = rt.get_input_line();
+				have_header = true;
+			}
+			else if(rt.get_last_error() != T_EOF) {
+				std::cerr<<"Error reading header in file "<<num<<":\n";
+				rt.write_error(std::cerr);
+				return false;
+			}
+		}
+		while(rt.read_line()) {
+			K id = K();
+			if(!GetID(rt,ks,id)) {
+				std::cerr<<"Error reading data from file "<<num<<":\n";
+				rt.write_error(std::cerr);
+				return false;
+			}
+			const std::string& line = rt.get_input_line(); /* note: the original line for converted input */
+			sort_entry e;
+			e.key = radix_key<K>::get(id);
+			e.pos = data.size();
+			e.len = line.size();
+			entries.push_back(e);
+			if(!radix_key<K>::use) keys.push_back(id);
+			data.append(line);
+			nlines++;
+			if(data.size() + entries.size()*2*sizeof(sort_entry) + keys.size()*sizeof(K) >= max_mem)
+				if(!write_run()) return false;
+		}
+		if(rt.get_last_error() != T_EOF) {
+			std::cerr<<"Error reading data from file "<<num<<":\n";
+			rt.write_error(std::cerr);
+			return false;
+		}
+	}
+	if(header && !have_header) {
+		std::cerr<<"Error reading header in file "<<num<<": empty input!\n";
+		return false;
+	}
+	if(entries.size() || runs.empty()) if(!write_run()) return false;
+	std::cerr<<"Sorted file "<<num<<": "<<nlines<<" lines in "<<runs.size()<<" block(s)\n";
+	fns = std::move(runs);
+	return true;
+}
+
+/* check if an input is a binary table already sorted on the join field
+ * (see tsv2bin), so it does not need to be sorted with -S */
+template<class K>
+static bool IsSortedBinary(const std::vector<std::string>& fns, const key_spec& ks, line_parser_params par) {
+	if(!std::is_same<K,int64_t>::value || fns.size() != 1 || fns[0] == "-") return false;
+	read_table2 rt(fns[0].c_str(),par);
+	const binary_table_reader* bin = rt.get_binary();
+	return bin && bin->get_sort_field() == (unsigned int)ks.fields[0];
+}
+
+/* sort all inputs if requested (-S) */
+template<class K>
+static bool SortInputs(const join_options& opt, std::vector<std::vector<std::string> >& input_files, temp_files& tmp) {
+	if(!opt.sort_input) return true;
+	unsigned int nthreads = std::thread::hardware_concurrency();
+	if(!nthreads) nthreads = 1;
+	for(size_t j=0;j<input_files.size();j++) {
+		line_parser_params par = opt.get_params(j);
+		if(IsSortedBinary<K>(input_files[j],opt.keys[j],par)) {
+			std::cerr<<"File "<<j+1<<" is already sorted, not sorting it again\n";
+			continue;
+		}
+		if(!SortInput<K>(input_files[j],j+1,opt.keys[j],par,opt.header,opt.max_mem,nthreads,tmp)) return false;
+	}
+	return true;
+}
+
+/*
+ * write the cross product of the current groups in inputs[i..];
+ * inputs[outer] is the one processed in blocks, its lines are not
+ * spilled to a temporary file (its current block is used only)
+ * sel contains the lines selected so far (NULL for files not having
+ * the current ID)
+ */
+template<class K>
+static bool WriteCombinations(join_output& out, write_buffer& sw, std::vector<join_input<K> >& inputs,
+		std::vector<const parsed_line*>& sel, size_t i, size_t outer, size_t& out_lines) {
+	if(i == inputs.size()) {
+		out.write_line(sw,sel.data());
+		out_lines++;
+		return true;
+	}
+	join_input<K>& in = inputs[i];
+	if(in.lines.empty() || in.id != inputs[outer].id) {
+		// this file does not have the current ID
+		sel[i] = 0;
+		return WriteCombinations(out,sw,inputs,sel,i+1,outer,out_lines);
+	}
+	for(const parsed_line& pl : in.lines) {
+		sel[i] = &pl;
+		if(!WriteCombinations(out,sw,inputs,sel,i+1,outer,out_lines)) return false;
+	}
+	if(i != outer && in.spilled) {
+		if(!in.spill.rewind()) { std::cerr<<"Error reading temporary file!\n"; return false; }
+		std::string tmp_str;
+		while(in.spill.read(tmp_str)) {
+			in.tmp.set_line(tmp_str);
+			sel[i] = &in.tmp;
+			if(!WriteCombinations(out,sw,inputs,sel,i+1,outer,out_lines)) return false;
+		}
+		if(in.spill.read_lines != in.spill.lines) { std::cerr<<"Error reading temporary file!\n"; return false; }
+	}
+	return true;
+}
+
+/*
+ * write all lines of the current group of a file (the current block and
+ * any lines spilled to a temporary file) to its separate output file of
+ * unpaired lines
+ */
+template<class K>
+static bool WriteUnpairedFile(join_output& out, join_input<K>& in) {
+	for(const parsed_line& pl : in.lines) out.write_unpaired_file(in.num-1,pl);
+	if(in.spilled) {
+		if(!in.spill.rewind()) { std::cerr<<"Error reading temporary file!\n"; return false; }
+		std::string tmp_str;
+		while(in.spill.read(tmp_str)) {
+			in.tmp.set_line(tmp_str);
+			out.write_unpaired_file(in.num-1,in.tmp);
+		}
+		if(in.spill.read_lines != in.spill.lines) { std::cerr<<"Error reading temporary file!\n"; return false; }
+	}
+	return true;
+}
+
+/*
+ * join any number of input files in one pass
+ * 
+ * in each step, the smallest ID among all files is processed: if all files
+ * have it, the combinations of all lines are written (unless only_unpaired);
+ * if only some, the lines are written only if one of the files with the ID
+ * has the unpaired flag set (with empty fields for the rest)
+ * if no unpaired lines are needed, files behind the largest current ID are
+ * advanced directly to it without splitting the lines that are skipped
+ */
+template<class K>
+static int JoinMultiple(const join_options& opt, std::vector<std::vector<std::string> >& input_files) {
+	join_output out(opt);
+	if(!out.open()) return 1;
+	bool only_unpaired = opt.only_unpaired;
+	bool header = opt.header;
+	size_t max_mem = opt.max_mem;
+	
+	std::vector<join_input<K> > inputs;
+	inputs.reserve(input_files.size());
+	for(size_t j=0;j<input_files.size();j++) {
+		inputs.emplace_back(std::move(input_files[j]),j+1,opt.keys[j],opt.get_params(j),header);
+		join_input<K>& in = inputs.back();
+		in.req_fields = opt.req_fields[j];
+		in.sr.set_max_fields(opt.split_fields(j));
+		in.tmp.max_fields = opt.split_fields(j);
+		in.unpaired = opt.unpaired_files[j];
+	}
+	
+	bool any_unpaired = false;
+	for(size_t j=0;j<inputs.size();j++) if(opt.need_unpaired(j)) any_unpaired = true;
+	
+	if(header) {
+		// read and write output header
+		for(join_input<K>& in : inputs) {
+			std::string line;
+			if(!in.sr.read_header(line)) {
+				std::cerr<<"Error reading header in file "<<in.num<<":\n";
+				in.sr.write_error(std::cerr);
+				return 1;
+			}
+			in.tmp.set_line(line);
+			if(in.tmp.fields.size() < in.req_fields) {
+				std::cerr<<"Error reading header in file "<<in.num<<":\n";
+				write_split_error(in.sr,in.tmp.parser,0);
+				return 1;
+			}
+		}
+	}
+	std::vector<const parsed_line*> headers;
+	for(const join_input<K>& in : inputs) headers.push_back(&in.tmp);
+	out.start(header ? headers.data() : 0);
+	
+	for(join_input<K>& in : inputs) if(!in.read_next(true,max_mem)) return 1;
+	
+	size_t out_lines = 0;
+	uint64_t spilled_groups = 0;
+	uint64_t spilled_lines = 0;
+	std::vector<const parsed_line*> sel(inputs.size());
+	bool error = false;
+	while(!error) {
+		// find the smallest and largest current IDs
+		size_t nonempty = 0;
+		K minid = K();
+		K maxid = K();
+		for(const join_input<K>& in : inputs) if(in.lines.size()) {
+			if(nonempty == 0 || in.id < minid) minid = in.id;
+			if(nonempty == 0 || maxid < in.id) maxid = in.id;
+			nonempty++;
+		}
+		if(nonempty == 0) break; // end of all files
+		if(!any_unpaired) {
+			if(nonempty < inputs.size()) break; // end of one file, no more matches possible
+			if(minid != maxid) {
+				// advance all files that are behind the largest ID
+				for(join_input<K>& in : inputs) if(in.id < maxid) {
+					while(in.more) if(!in.read_next(false,max_mem)) return 1;
+					if(in.group > in.max_group) in.max_group = in.group;
+					in.group = 0;
+					in.lines.clear();
+					if(!in.check_order()) { error = true; break; }
+					bool sorted;
+					if(!SkipTo(in.sr,maxid,in.nextid,sorted)) {
+						std::cerr<<"Error reading data from file "<<in.num<<":\n";
+						in.sr.write_error(std::cerr);
+						return 1;
+					}
+					if(!sorted) {
+						const char* fn = in.sr.get_fn();
+						std::cerr<<"Error: input file "<<in.num<<" ("<<(fn?fn:"<stdin>");
+						std::cerr<<") not sorted on line "<<in.sr.get_line()<<"!\n";
+						error = true;
+						break;
+					}
+					if(!in.read_next(false,max_mem)) return 1;
+				}
+				continue;
+			}
+		}
+		
+		// process the current ID: find which files have it
+		size_t outer = inputs.size();
+		size_t matching = 0;
+		bool unpaired = false;
+		for(size_t i=0;i<inputs.size();i++) {
+			const join_input<K>& in = inputs[i];
+			if(in.lines.size() && in.id == minid) {
+				matching++;
+				if(in.unpaired) unpaired = true;
+				if(outer == inputs.size()) outer = i;
+			}
+		}
+		bool write = false;
+		if(matching == inputs.size()) write = !only_unpaired;
+		else write = unpaired;
+		// lines of file i are written to its separate file of unpaired lines
+		auto to_file = [&](size_t i) {
+			const join_input<K>& in = inputs[i];
+			return matching < inputs.size() && in.lines.size() && in.id == minid && out.unpaired_sw[i];
+		};
+		
+		if(write) {
+			// write all combinations; all files except the first one are
+			// read fully, writing lines to a temporary file if needed
+			for(size_t i=outer+1;i<inputs.size();i++) {
+				join_input<K>& in = inputs[i];
+				if(in.lines.size() && in.id == minid && in.more) {
+					if(!in.spill.reset()) { std::cerr<<"Error creating temporary file!\n"; return 1; }
+					if( !(SpillRest(in.sr,in.spill,in.id,in.nextid,in.req_fields,in.tmp)) ) {
+						std::cerr<<"Error reading data from file "<<in.num<<":\n";
+						in.sr.write_error(std::cerr);
+						return 1;
+					}
+					in.spilled = true;
+					in.more = false;
+					in.group += in.spill.lines;
+					spilled_groups++;
+					spilled_lines += in.spill.lines;
+				}
+				if(to_file(i) && !WriteUnpairedFile(out,in)) return 1;
+			}
+			join_input<K>& in1 = inputs[outer];
+			while(true) {
+				if(!WriteCombinations(out,out.get(minid),inputs,sel,0,outer,out_lines)) return 1;
+				if(to_file(outer)) for(const parsed_line& pl : in1.lines) out.write_unpaired_file(outer,pl);
+				if(!in1.more) break;
+				if(!in1.read_next(false,max_mem)) return 1;
+			}
+		}
+		
+		// advance all files with the current ID (writing unpaired lines
+		// to separate files here if not done above)
+		for(size_t i=0;i<inputs.size();i++) {
+			join_input<K>& in = inputs[i];
+			if(!(in.lines.size() && in.id == minid)) continue;
+			bool file = to_file(i);
+			if(file && !write) for(const parsed_line& pl : in.lines) out.write_unpaired_file(i,pl);
+			while(in.more) {
+				if(!in.read_next(false,max_mem)) return 1;
+				if(file && !write) for(const parsed_line& pl : in.lines) out.write_unpaired_file(i,pl);
+			}
+			if(matching == inputs.size()) { if(write) in.matched += in.group; }
+			else if(write || file) in.unmatched += in.group;
+		}
+		for(join_input<K>& in : inputs) if(in.lines.size() && in.id == minid)
+			if(!in.advance(max_mem)) { error = true; break; }
+	}
+	
+	if(!out.finish()) error = true;
+	
+	for(const join_input<K>& in : inputs) {
+		std::cerr<<"Matched lines from file "<<in.num<<": "<<in.matched<<'\n';
+		if(in.unmatched > 0) std::cerr<<"Unmatched lines from file "<<in.num<<": "<<in.unmatched<<'\n';
+	}
+	std::cerr<<"Total lines output: "<<out_lines<<'\n';
+	for(const join_input<K>& in : inputs)
+		std::cerr<<"Largest group of lines with the same ID in file "<<in.num<<": "<<in.max_group<<'\n';
+	if(spilled_groups > 0) std::cerr<<"Groups written to temporary file: "<<spilled_groups<<" ("<<spilled_lines<<" lines)\n";
+	return error ? 1 : 0;
+}
+
+/* join two files */
+template<class K>
+static int JoinTwo(const join_options& opt, std::vector<std::vector<std::string> >& input_files) {
+	const key_spec& field1 = opt.keys[0];
+	const key_spec& field2 = opt.keys[1];
+	int req_fields1 = opt.req_fields[0];
+	int req_fields2 = opt.req_fields[1];
+	// unpaired lines needed from one of the files (at most one if joining
+	// two files, see Join())
+	int unpaired = opt.need_unpaired(0) ? 1 : (opt.need_unpaired(1) ? 2 : 0);
+	bool only_unpaired = opt.only_unpaired;
+	bool header = opt.header;
+	bool strict_order = opt.strict_order;
+	size_t max_mem = opt.max_mem;
+	line_parser_params par1 = opt.get_params(0);
+	line_parser_params par2 = opt.get_params(1);
+	
+	join_output out(opt);
+	if(!out.open()) return 1;
+	sorted_input<K> s1(std::move(input_files[0]),field1,par1,header);
+	sorted_input<K> s2(std::move(input_files[1]),field2,par2,header);
+	s1.set_max_fields(opt.split_fields(0));
+	s2.set_max_fields(opt.split_fields(1));
+	
+	K id1 = K();
+	K id2 = K();
+	
+	std::vector<parsed_line> lines1;
+	K nextid1 = K();
+	std::vector<parsed_line> lines2;
+	K nextid2 = K();
+	
+	
+	if(header) {
+		// read and write output header
+		std::string header1, header2;
+		if(!s1.read_header(header1)) {
+			std::cerr<<"Error reading header in file 1:\n";
+			s1.write_error(std::cerr);
+			return 1;
+		}
+		if(!s2.read_header(header2)) {
+			std::cerr<<"Error reading header in file 2:\n";
+			s2.write_error(std::cerr);
+			return 1;
+		}
+		// note: all fields are split (unless written as-is), so that all
+		// of them are written if no output fields are given
+		parsed_line h1(par1,header1,req_fields1,s1.get_max_fields());
+		parsed_line h2(par2,header2,req_fields2,s2.get_max_fields());
+		if(h1.fields.size() < (size_t)req_fields1) {
+			std::cerr<<"Error reading header in file 1:\n"<<h1.parser.get_last_error_str()<<"\n";
+			return 1;
+		}
+		if(h2.fields.size() < (size_t)req_fields2) {
+			std::cerr<<"Error reading header in file 2:\n"<<h2.parser.get_last_error_str()<<"\n";
+			return 1;
+		}
+		
+		const parsed_line* headers[2] = {&h1, &h2};
+		out.start(headers);
+	}
+	else out.start(0);
+	
+	bool more1 = false; // true if there are more lines with id1 in file 1 not read yet
+	bool more2 = false; // true if there are more lines with id2 in file 2 not read yet
+	spill_file spill2; // lines from file 2 with the current ID that did not fit in memory
+	parsed_line tmp_line(par2,std::string(),req_fields2,s2.get_max_fields());
+	std::string tmp_str;
+	
+	// read first lines
+	if( !ReadNext(s1,lines1,id1,nextid1,req_fields1,true,max_mem,more1) ) {
 		std::cerr<<"Error reading data from file 1:\n";
 		s1.write_error(std::cerr);
 		return 1;
 	}
-	if( !ReadNext(s2,lines2,id2,nextid2,field2,req_fields2,true) ) {
+	if( !ReadNext(s2,lines2,id2,nextid2,req_fields2,true,max_mem,more2) ) {
 		std::cerr<<"Error reading data from file 2:\n";
 		s2.write_error(std::cerr);
 		return 1;
@@ -375,6 +1921,12 @@ int main(int argc, char** args) {
 	size_t matched1 = 0;
 	size_t matched2 = 0;
 	size_t unmatched = 0;
+	uint64_t group1 = 0; // size of the current group of lines with the same ID
+	uint64_t group2 = 0;
+	uint64_t max_group1 = 0; // largest groups seen
+	uint64_t max_group2 = 0;
+	uint64_t spilled_groups = 0; // number of groups written to a temporary file
+	uint64_t spilled_lines = 0;
 	while(true) {
 		if(lines1.empty() && lines2.empty()) break; // end of both files
 		if(lines1.empty() && unpaired != 2) break; // end of first file and we don't care about unpaired
@@ -383,43 +1935,93 @@ int main(int argc, char** args) {
 			// match, write out (if needed -- not only_unpaired)
 			// there could be several lines from both files, iterate
 			// over the cross product
-			if(!only_unpaired) {
-				matched1 += lines1.size();
-				matched2 += lines2.size();
-				for(size_t j=0;j<lines1.size();j++)
-				for(size_t k=0;k<lines2.size();k++) {
-					// write out fields from the first file
-					bool firstout = true;
-					if(!outfields1_empty) WriteFields(sw,lines1[j].fields,lines1[j].get_line_str(),outfields1,firstout,out_sep);
-					if(!outfields2_empty) WriteFields(sw,lines2[k].fields,lines2[k].get_line_str(),outfields2,firstout,out_sep);
-					sw<<'\n';
-					out_lines++;
+			// if there are too many lines, lines from file 1 are processed
+			// in blocks, while lines from file 2 that do not fit in memory
+			// are written to a temporary file and re-read for each line
+			// from file 1 (this keeps the output order the same)
+			write_buffer& sw = out.get(id1);
+			group2 = lines2.size();
+			bool spilled = false;
+			if(more2 && !only_unpaired) {
+				if(!spill2.reset()) { std::cerr<<"Error creating temporary file!\n"; return 1; }
+				if( !(SpillRest(s2,spill2,id2,nextid2,req_fields2,tmp_line)) ) {
+					std::cerr<<"Error reading data from file 2:\n";
+					s2.write_error(std::cerr);
+					return 1;
+				}
+				spilled = true;
+				more2 = false;
+				group2 += spill2.lines;
+				spilled_groups++;
+				spilled_lines += spill2.lines;
+			}
+			group1 = 0;
+			while(true) {
+				group1 += lines1.size();
+				if(!only_unpaired) {
+					matched1 += lines1.size();
+					for(size_t j=0;j<lines1.size();j++) {
+						const parsed_line* l[2] = {&lines1[j], 0};
+						for(size_t k=0;k<lines2.size();k++) {
+							l[1] = &lines2[k];
+							out.write_line(sw,l);
+							out_lines++;
+						}
+						if(spilled) {
+							if(!spill2.rewind()) { std::cerr<<"Error reading temporary file!\n"; return 1; }
+							while(spill2.read(tmp_str)) {
+								tmp_line.set_line(tmp_str);
+								l[1] = &tmp_line;
+								out.write_line(sw,l);
+								out_lines++;
+							}
+							if(spill2.read_lines != spill2.lines) { std::cerr<<"Error reading temporary file!\n"; return 1; }
+						}
+					}
+				}
+				if(!more1) break;
+				if( !ReadNext(s1,lines1,id1,nextid1,req_fields1,false,max_mem,more1) ) {
+					std::cerr<<"Error reading data from file 1:\n";
+					s1.write_error(std::cerr);
+					return 1;
 				}
 			}
+			// note: lines from file 2 are not needed if only_unpaired
+			while(more2) {
+				if( !ReadNext(s2,lines2,id2,nextid2,req_fields2,false,max_mem,more2) ) {
+					std::cerr<<"Error reading data from file 2:\n";
+					s2.write_error(std::cerr);
+					return 1;
+				}
+				group2 += lines2.size();
+			}
+			if(!only_unpaired) matched2 += group2;
+			if(group1 > max_group1) max_group1 = group1;
+			if(group2 > max_group2) max_group2 = group2;
 			lines1.clear();
 			lines2.clear();
 			
 			if(strict_order) {
 				// check order
 				if(nextid1 < id1) {
-					std::cerr<<"Error: input file 1 ("<<(file1?file1:"<stdin>");
+					std::cerr<<"Error: input file 1 ("<<(s1.get_fn()?s1.get_fn():"<stdin>");
 					std::cerr<<") not sorted on line "<<s1.get_line()<<" ( "<<nextid1<<" < "<<id1<<")!\n";
 					break;
 				}
 				if(nextid2 < id2) {
-					std::cerr<<"Error: input file 2 ("<<(file2?file2:"<stdin>");
+					std::cerr<<"Error: input file 2 ("<<(s2.get_fn()?s2.get_fn():"<stdin>");
 					std::cerr<<") not sorted on line "<<s2.get_line()<<" ( "<<nextid2<<" < "<<id2<<")!\n";
 					break;
 				}
 			}
 			
 			// read next lines
-			if( !ReadNext(s1,lines1,id1,nextid1,field1,req_fields1,false) ) {
+			if( !ReadNext(s1,lines1,id1,nextid1,req_fields1,false,max_mem,more1) ) {
 				std::cerr<<"Error reading data from file 1:\n";
 				s1.write_error(std::cerr);
 				return 1;
 			}
-			if( !ReadNext(s2,lines2,id2,nextid2,field2,req_fields2,false) ) {
+			if( !ReadNext(s2,lines2,id2,nextid2,req_fields2,false,max_mem,more2) ) {
 				std::cerr<<"Error reading data from file 2:\n";
 				s2.write_error(std::cerr);
 				return 1;
@@ -431,27 +2033,35 @@ int main(int argc, char** args) {
 		
 		// need to advance file1
 		if(lines1.size() > 0 && (lines2.empty() || id1 < id2)) {
-			// check if lines from file 1 should be output if not matched
-			if(unpaired == 1) for(size_t j=0;j<lines1.size();j++) {
-				// still print unpaired lines from file 1
-				bool firstout = true;
-				if(!outfields1_empty) WriteFields(sw,lines1[j].fields,lines1[j].get_line_str(),outfields1,firstout,out_sep);
-				// note: we write empty fields for file 2
-				if(!outfields2.empty()) WriteFields(sw,std::vector<std::pair<size_t,size_t> >(),std::string(),outfields2,firstout,out_sep);
-				sw<<'\n';
-				out_lines++;
-				unmatched++;
+			write_buffer& sw = out.get(id1);
+			group1 = 0;
+			while(true) {
+				group1 += lines1.size();
+				// check if lines from file 1 should be output if not matched
+				if(unpaired == 1) for(size_t j=0;j<lines1.size();j++) {
+					// still print unpaired lines from file 1
+					// (with empty fields for file 2)
+					if(out.write_unpaired(0,lines1[j],sw)) out_lines++;
+					unmatched++;
+				}
+				if(!more1) break;
+				if( !ReadNext(s1,lines1,id1,nextid1,req_fields1,false,max_mem,more1) ) {
+					std::cerr<<"Error reading data from file 1:\n";
+					s1.write_error(std::cerr);
+					return 1;
+				}
 			}
+			if(group1 > max_group1) max_group1 = group1;
 			lines1.clear();
 			
 			// first check sort order, that could be a problem here
 			if(nextid1 < id1) {
-				std::cerr<<"Error: input file 1 ("<<(file1?file1:"<stdin>");
+				std::cerr<<"Error: input file 1 ("<<(s1.get_fn()?s1.get_fn():"<stdin>");
 				std::cerr<<") not sorted on line "<<s1.get_line()<<" ( "<<nextid1<<" < "<<id1<<")!\n";
 				break;
 			}
 			// then advance file 1
-			if( !ReadNext(s1,lines1,id1,nextid1,field1,req_fields1,false) ) {
+			if( !ReadNext(s1,lines1,id1,nextid1,req_fields1,false,max_mem,more1) ) {
 				std::cerr<<"Error reading data from file 1:\n";
 				s1.write_error(std::cerr);
 				return 1;
@@ -459,27 +2069,35 @@ int main(int argc, char** args) {
 		}
 		else {
 			// here id2 < id1 or end of file1 already
-			// check if lines from file 2 should be output if not matched
-			if(unpaired == 2) for(size_t j=0;j<lines2.size();j++) {
-				// still print unpaired lines from file 2
-				bool firstout = true;
-				// note: we write empty fields for file 1
-				if(!outfields1.empty()) WriteFields(sw,std::vector<std::pair<size_t,size_t> >(),std::string(),outfields1,firstout,out_sep);
-				if(!outfields2_empty) WriteFields(sw,lines2[j].fields,lines2[j].get_line_str(),outfields2,firstout,out_sep);
-				sw<<'\n';
-				out_lines++;
-				unmatched++;
+			write_buffer& sw = out.get(id2);
+			group2 = 0;
+			while(true) {
+				group2 += lines2.size();
+				// check if lines from file 2 should be output if not matched
+				if(unpaired == 2) for(size_t j=0;j<lines2.size();j++) {
+					// still print unpaired lines from file 2
+					// (with empty fields for file 1)
+					if(out.write_unpaired(1,lines2[j],sw)) out_lines++;
+					unmatched++;
+				}
+				if(!more2) break;
+				if( !ReadNext(s2,lines2,id2,nextid2,req_fields2,false,max_mem,more2) ) {
+					std::cerr<<"Error reading data from file 2:\n";
+					s2.write_error(std::cerr);
+					return 1;
+				}
 			}
+			if(group2 > max_group2) max_group2 = group2;
 			lines2.clear();
 			
 			// first check sort order, that could be a problem here
 			if(nextid2 < id2) {
-				std::cerr<<"Error: input file 2 ("<<(file2?file2:"<stdin>");
+				std::cerr<<"Error: input file 2 ("<<(s2.get_fn()?s2.get_fn():"<stdin>");
 				std::cerr<<") not sorted on line "<<s2.get_line()<<" ( "<<nextid2<<" < "<<id2<<")!\n";
 				break;
 			}
 			
-			if( !ReadNext(s2,lines2,id2,nextid2,field2,req_fields2,false) ) {
+			if( !ReadNext(s2,lines2,id2,nextid2,req_fields2,false,max_mem,more2) ) {
 				std::cerr<<"Error reading data from file 2:\n";
 				s2.write_error(std::cerr);
 				return 1;
@@ -488,7 +2106,7 @@ int main(int argc, char** args) {
 	} // main loop
 	
 	
-	sw.flush(); // flush output
+	bool write_ok = out.finish();
 	
 	std::cerr<<"Matched lines from file 1: "<<matched1<<'\n';
 	std::cerr<<"Matched lines from file 2: "<<matched2<<'\n';
@@ -501,9 +2119,1008 @@ int main(int argc, char** args) {
 			break;
 	}
 	std::cerr<<"Total lines output: "<<out_lines<<'\n';
+	std::cerr<<"Largest group of lines with the same ID in file 1: "<<max_group1<<'\n';
+	std::cerr<<"Largest group of lines with the same ID in file 2: "<<max_group2<<'\n';
+	if(spilled_groups > 0) std::cerr<<"Groups written to temporary file: "<<spilled_groups<<" ("<<spilled_lines<<" lines)\n";
+	return write_ok ? 0 : 1;
+}
+
+/*
+ * arithmetic on join keys for range joins (only for numeric keys);
+ * results are saturated instead of overflowing
+ */
+static int64_t KeyAdd(int64_t a, int64_t d) {
+	int64_t r;
+	if(__builtin_add_overflow(a,d,&r)) return d > 0 ? INT64_MAX : INT64_MIN;
+	return r;
+}
+static int64_t KeySub(int64_t a, int64_t d) {
+	int64_t r;
+	if(__builtin_sub_overflow(a,d,&r)) return d > 0 ? INT64_MIN : INT64_MAX;
+	return r;
 }
+static uint64_t KeyAdd(uint64_t a, uint64_t d) { return a > UINT64_MAX - d ? UINT64_MAX : a + d; }
+static uint64_t KeySub(uint64_t a, uint64_t d) { return a < d ? 0 : a - d; }
+static double KeyAdd(double a, double d) { return a + d; }
+static double KeySub(double a, double d) { return a - d; }
+static fixed_point KeyAdd(fixed_point a, const fixed_point& d) { a.v = KeyAdd(a.v,d.v); return a; }
+static fixed_point KeySub(fixed_point a, const fixed_point& d) { a.v = KeySub(a.v,d.v); return a; }
+static timestamp KeyAdd(timestamp a, const timestamp& d) { a.ns = KeyAdd(a.ns,d.ns); return a; }
+static timestamp KeySub(timestamp a, const timestamp& d) { a.ns = KeySub(a.ns,d.ns); return a; }
 
+/*
+ * one input file of a range join, read line by line; the sort order is
+ * checked for each line
+ */
+template<class K>
+struct range_input {
+	sorted_input<K> sr;
+	int num; /* number of this file, counted from 1 */
+	size_t req_fields;
+	size_t max_fields; /* number of fields to split */
+	K id; /* ID of the current line */
+	bool valid; /* true if there is a current line (false at the end) */
+	uint64_t matched;
+	uint64_t unmatched;
+	
+	range_input(std::vector<std::string>&& fns, int num_, const key_spec& ks, line_parser_params par,
+			bool header, size_t req_fields_, size_t max_fields_):sr(std::move(fns),ks,par,header),num(num_),req_fields(req_fields_),
+			max_fields(max_fields_),id(),valid(false),matched(0),unmatched(0) { }
+	
+	/* read the next line; returns false on error (after writing an error message) */
+	bool next() {
+		K previd = id;
+		bool first = !valid;
+		if(!sr.next(id)) {
+			valid = false;
+			if(sr.get_last_error() == T_EOF) return true;
+			std::cerr<<"Error reading data from file "<<num<<":\n";
+			sr.write_error(std::cerr);
+			return false;
+		}
+		if(!first && id < previd) {
+			const char* fn = sr.get_fn();
+			std::cerr<<"Error: input file "<<num<<" ("<<(fn?fn:"<stdin>");
+			std::cerr<<") not sorted on line "<<sr.get_line()<<" ( "<<id<<" < "<<previd<<")!\n";
+			valid = false;
+			return false;
+		}
+		valid = true;
+		return true;
+	}
+	/* split the current line into pl; returns false if it has too few fields */
+	bool split(parsed_line& pl) const {
+		pl.set_line(sr.get_line_str());
+		if(pl.fields.size() < req_fields) {
+			std::cerr<<"Error reading data from file "<<num<<":\n";
+			write_split_error(sr,pl.parser,0);
+			return false;
+		}
+		return true;
+	}
+	/* read and split the header line */
+	bool read_header(parsed_line& pl) {
+		std::string line;
+		if(!sr.read_header(line)) {
+			std::cerr<<"Error reading header in file "<<num<<":\n";
+			sr.write_error(std::cerr);
+			return false;
+		}
+		pl.set_line(line);
+		if(pl.fields.size() < req_fields) {
+			std::cerr<<"Error reading header in file "<<num<<":\n";
+			write_split_error(sr,pl.parser,0);
+			return false;
+		}
+		return true;
+	}
+};
+
+/* write one output line of a range join; l1 or l2 is NULL for unpaired lines */
+static void WriteRangeLine(join_output& out, const parsed_line* l1, const parsed_line* l2) {
+	const parsed_line* l[2] = {l1, l2};
+	out.write_line(out.sw,l);
+}
 
+/* write the header of a range join (or set up the output if there is none) */
+static void StartRangeOutput(join_output& out, const parsed_line* h1, const parsed_line* h2) {
+	const parsed_line* h[2] = {h1, h2};
+	out.start(h1 ? h : 0);
+}
 
+/* line from file 1 kept in the window of a band join */
+template<class K>
+struct band_line {
+	parsed_line line;
+	K id;
+	bool matched;
+	band_line(parsed_line&& line_, const K& id_):line(std::move(line_)),id(id_),matched(false) { }
+};
 
+/*
+ * band join: match lines where the join fields differ by at most dist
+ * 
+ * file 2 is processed line by line, lines from file 1 that are within dist
+ * of the current line are kept in a sliding window (a queue sorted by the
+ * join field), so only one pass is needed over both files; output is in the
+ * order of lines in file 2
+ */
+template<class K>
+static int JoinBand(const join_options& opt, std::vector<std::vector<std::string> >& input_files, const K& dist) {
+	join_output out(opt);
+	if(!out.open()) return 1;
+	line_parser_params par1 = opt.get_params(0);
+	line_parser_params par2 = opt.get_params(1);
+	range_input<K> in1(std::move(input_files[0]),1,opt.keys[0],par1,opt.header,opt.req_fields[0],opt.split_fields(0));
+	range_input<K> in2(std::move(input_files[1]),2,opt.keys[1],par2,opt.header,opt.req_fields[1],opt.split_fields(1));
+	bool unpaired1 = opt.need_unpaired(0);
+	bool unpaired2 = opt.need_unpaired(1);
+	parsed_line tmp1(par1,std::string(),opt.req_fields[0],in1.max_fields);
+	parsed_line tmp2(par2,std::string(),opt.req_fields[1],in2.max_fields);
+	
+	if(opt.header) {
+		if(!(in1.read_header(tmp1) && in2.read_header(tmp2))) return 1;
+		StartRangeOutput(out,&tmp1,&tmp2);
+	}
+	else StartRangeOutput(out,0,0);
+	
+	std::deque<band_line<K> > window;
+	size_t max_window = 0;
+	uint64_t out_lines = 0;
+	bool error = false;
+	
+	/* remove the first line from the window (writing it if unpaired) */
+	auto pop = [&]() {
+		band_line<K>& bl = window.front();
+		if(bl.matched) in1.matched++;
+		else if(unpaired1) {
+			if(out.write_unpaired(0,bl.line)) out_lines++;
+			in1.unmatched++;
+		}
+		window.pop_front();
+	};
+	
+	if(!(in1.next() && in2.next())) error = true;
+	while(!error && in2.valid) {
+		K lo = KeySub(in2.id,dist);
+		K hi = KeyAdd(in2.id,dist);
+		// lines from file 1 before the range cannot match any more lines
+		while(window.size() && window.front().id < lo) pop();
+		// add lines from file 1 that are in the range
+		while(in1.valid && !(hi < in1.id)) {
+			if(in1.id < lo) {
+				if(unpaired1) {
+					if(!in1.split(tmp1)) { error = true; break; }
+					if(out.write_unpaired(0,tmp1)) out_lines++;
+					in1.unmatched++;
+				}
+			}
+			else {
+				parsed_line pl(par1,in1.sr.get_line_str(),opt.req_fields[0],in1.max_fields);
+				if(pl.fields.size() < in1.req_fields) {
+					std::cerr<<"Error reading data from file 1:\n";
+					write_split_error(in1.sr,pl.parser,0);
+					error = true;
+					break;
+				}
+				window.emplace_back(std::move(pl),in1.id);
+			}
+			if(!in1.next()) { error = true; break; }
+		}
+		if(error) break;
+		if(window.size() > max_window) max_window = window.size();
+		
+		if(window.size() || unpaired2) if(!in2.split(tmp2)) { error = true; break; }
+		if(window.empty()) {
+			if(unpaired2) {
+				if(out.write_unpaired(1,tmp2)) out_lines++;
+				in2.unmatched++;
+			}
+		}
+		else {
+			in2.matched++;
+			for(band_line<K>& bl : window) {
+				bl.matched = true;
+				if(!opt.only_unpaired) {
+					WriteRangeLine(out,&bl.line,&tmp2);
+					out_lines++;
+				}
+			}
+		}
+		if(!in2.next()) error = true;
+	}
+	
+	if(!error) {
+		while(window.size()) pop();
+		if(unpaired1) while(in1.valid) {
+			if(!in1.split(tmp1)) { error = true; break; }
+			if(out.write_unpaired(0,tmp1)) out_lines++;
+			in1.unmatched++;
+			if(!in1.next()) { error = true; break; }
+		}
+	}
+	
+	if(!out.finish()) error = true;
+	
+	std::cerr<<"Matched lines from file 1: "<<in1.matched<<'\n';
+	std::cerr<<"Matched lines from file 2: "<<in2.matched<<'\n';
+	if(in1.unmatched > 0) std::cerr<<"Unmatched lines from file 1: "<<in1.unmatched<<'\n';
+	if(in2.unmatched > 0) std::cerr<<"Unmatched lines from file 2: "<<in2.unmatched<<'\n';
+	std::cerr<<"Total lines output: "<<out_lines<<'\n';
+	std::cerr<<"Largest number of lines from file 1 in the window: "<<max_window<<'\n';
+	return error ? 1 : 0;
+}
+
+/*
+ * interval join: lines in file 1 describe intervals, starting at the join
+ * field and ending at end_ks (inclusive), lines in file 2 are points (given
+ * by their join field); each point is paired with all intervals containing it
+ * 
+ * file 1 has to be sorted by the start of the intervals and file 2 by the
+ * points; intervals that started before the current point are kept in a
+ * heap ordered by their end, so that ones that cannot contain any more
+ * points can be removed; this needs one pass over both files and the cost
+ * is proportional to the size of the inputs and the output (plus a
+ * logarithmic factor for the heap operations)
+ * output is in the order of lines in file 2, intervals containing the same
+ * point are written in no particular order
+ */
+template<class K>
+static int JoinInterval(const join_options& opt, std::vector<std::vector<std::string> >& input_files, const key_spec& end_ks) {
+	join_output out(opt);
+	if(!out.open()) return 1;
+	line_parser_params par1 = opt.get_params(0);
+	line_parser_params par2 = opt.get_params(1);
+	size_t req_fields1 = opt.req_fields[0];
+	if((size_t)end_ks.fields[0] > req_fields1) req_fields1 = end_ks.fields[0];
+	range_input<K> in1(std::move(input_files[0]),1,opt.keys[0],par1,opt.header,req_fields1,
+		opt.split_fields(0) == SIZE_MAX ? SIZE_MAX : req_fields1);
+	range_input<K> in2(std::move(input_files[1]),2,opt.keys[1],par2,opt.header,opt.req_fields[1],opt.split_fields(1));
+	bool unpaired1 = opt.need_unpaired(0);
+	bool unpaired2 = opt.need_unpaired(1);
+	parsed_line tmp2(par2,std::string(),opt.req_fields[1],in2.max_fields);
+	
+	/* intervals currently active: lines are stored in slots that are
+	 * reused, the heap contains the end of each interval and its slot */
+	std::vector<parsed_line> slots;
+	std::vector<bool> slot_matched;
+	std::vector<size_t> free_slots;
+	std::vector<std::pair<K,size_t> > active;
+	auto heap_cmp = [](const std::pair<K,size_t>& a, const std::pair<K,size_t>& b) { return b.first < a.first; };
+	
+	if(opt.header) {
+		slots.emplace_back(par1,std::string(),req_fields1,in1.max_fields);
+		if(!(in1.read_header(slots[0]) && in2.read_header(tmp2))) return 1;
+		StartRangeOutput(out,&slots[0],&tmp2);
+		free_slots.push_back(0);
+		slot_matched.push_back(false);
+	}
+	else StartRangeOutput(out,0,0);
+	
+	size_t max_active = 0;
+	uint64_t out_lines = 0;
+	bool error = false;
+	
+	/* write an interval that did not contain any point if needed */
+	auto write_unpaired1 = [&](const parsed_line& pl) {
+		if(unpaired1) {
+			if(out.write_unpaired(0,pl)) out_lines++;
+			in1.unmatched++;
+		}
+	};
+	/* remove the interval with the earliest end */
+	auto pop = [&]() {
+		size_t i = active.front().second;
+		std::pop_heap(active.begin(),active.end(),heap_cmp);
+		active.pop_back();
+		if(slot_matched[i]) in1.matched++;
+		else write_unpaired1(slots[i]);
+		free_slots.push_back(i);
+	};
+	/* read the current line of file 1 into a free slot and parse its end */
+	auto read_interval = [&](size_t& i, K& end) -> bool {
+		if(free_slots.empty()) {
+			free_slots.push_back(slots.size());
+			slots.emplace_back(par1,std::string(),req_fields1,in1.max_fields);
+			slot_matched.push_back(false);
+		}
+		i = free_slots.back();
+		if(!in1.split(slots[i])) return false;
+		slots[i].parser.reset_pos();
+		if(!GetID(slots[i].parser,end_ks,end)) {
+			std::cerr<<"Error reading data from file 1:\n";
+			write_split_error(in1.sr,slots[i].parser,0);
+			return false;
+		}
+		if(end < in1.id) {
+			std::cerr<<"Error: interval end before its start in file 1 on line "<<in1.sr.get_line()<<"!\n";
+			return false;
+		}
+		free_slots.pop_back();
+		slot_matched[i] = false;
+		return true;
+	};
+	
+	if(!(in1.next() && in2.next())) error = true;
+	while(!error && in2.valid) {
+		const K& p = in2.id;
+		// add intervals that start before the current point
+		while(in1.valid && !(p < in1.id)) {
+			size_t i;
+			K end;
+			if(!read_interval(i,end)) { error = true; break; }
+			if(end < p) {
+				// interval is over already, it cannot contain any point
+				write_unpaired1(slots[i]);
+				free_slots.push_back(i);
+			}
+			else {
+				active.emplace_back(end,i);
+				std::push_heap(active.begin(),active.end(),heap_cmp);
+			}
+			if(!in1.next()) { error = true; break; }
+		}
+		if(error) break;
+		// remove intervals that end before the current point
+		while(active.size() && active.front().first < p) pop();
+		if(active.size() > max_active) max_active = active.size();
+		
+		// all remaining intervals contain the current point
+		if(active.size() || unpaired2) if(!in2.split(tmp2)) { error = true; break; }
+		if(active.empty()) {
+			if(unpaired2) {
+				if(out.write_unpaired(1,tmp2)) out_lines++;
+				in2.unmatched++;
+			}
+		}
+		else {
+			in2.matched++;
+			for(const auto& x : active) {
+				slot_matched[x.second] = true;
+				if(!opt.only_unpaired) {
+					WriteRangeLine(out,&slots[x.second],&tmp2);
+					out_lines++;
+				}
+			}
+		}
+		if(!in2.next()) error = true;
+	}
+	
+	if(!error) {
+		while(active.size()) pop();
+		if(unpaired1) while(in1.valid) {
+			size_t i;
+			K end;
+			if(!read_interval(i,end)) { error = true; break; }
+			write_unpaired1(slots[i]);
+			free_slots.push_back(i);
+			if(!in1.next()) { error = true; break; }
+		}
+	}
+	
+	if(!out.finish()) error = true;
+	
+	std::cerr<<"Matched lines from file 1: "<<in1.matched<<'\n';
+	std::cerr<<"Matched lines from file 2: "<<in2.matched<<'\n';
+	if(in1.unmatched > 0) std::cerr<<"Unmatched lines from file 1: "<<in1.unmatched<<'\n';
+	if(in2.unmatched > 0) std::cerr<<"Unmatched lines from file 2: "<<in2.unmatched<<'\n';
+	std::cerr<<"Total lines output: "<<out_lines<<'\n';
+	std::cerr<<"Largest number of active intervals: "<<max_active<<'\n';
+	return error ? 1 : 0;
+}
+
+/* direction of matches in an as-of join */
+enum asof_direction { ASOF_BACKWARD, ASOF_FORWARD, ASOF_NEAREST };
+
+/*
+ * as-of join: each line in file 2 is paired with (at most) one line from
+ * file 1: the one with the largest join field not after it (backward), the
+ * one with the smallest join field not before it (forward) or the closer
+ * of these (nearest; ties are resolved as backward); if there are several
+ * lines with the same join field, the last one is used for backward
+ * matches and the first one for forward matches
+ * optionally, matches are only accepted if the join fields differ by at
+ * most tol
+ * 
+ * only the last line from file 1 before the current line of file 2 and the
+ * next one are kept in memory
+ */
+template<class K>
+static int JoinAsof(const join_options& opt, std::vector<std::vector<std::string> >& input_files,
+		asof_direction dir, bool has_tol, const K& tol) {
+	join_output out(opt);
+	if(!out.open()) return 1;
+	line_parser_params par1 = opt.get_params(0);
+	line_parser_params par2 = opt.get_params(1);
+	range_input<K> in1(std::move(input_files[0]),1,opt.keys[0],par1,opt.header,opt.req_fields[0],opt.split_fields(0));
+	range_input<K> in2(std::move(input_files[1]),2,opt.keys[1],par2,opt.header,opt.req_fields[1],opt.split_fields(1));
+	bool unpaired1 = opt.need_unpaired(0);
+	bool unpaired2 = opt.need_unpaired(1);
+	parsed_line tmp2(par2,std::string(),opt.req_fields[1],in2.max_fields);
+	/* storage for the previous and the current line from file 1 */
+	std::vector<parsed_line> lines1;
+	lines1.emplace_back(par1,std::string(),opt.req_fields[0],in1.max_fields);
+	lines1.emplace_back(par1,std::string(),opt.req_fields[0],in1.max_fields);
+	size_t cur = 0; /* index of the current line in lines1 (the other one is prev) */
+	bool cur_split = false; /* current line was already stored in lines1[cur] */
+	bool cur_matched = false;
+	K prev_id = K();
+	bool have_prev = false;
+	bool prev_matched = false;
+	
+	if(opt.header) {
+		if(!(in1.read_header(lines1[0]) && in2.read_header(tmp2))) return 1;
+		StartRangeOutput(out,&lines1[0],&tmp2);
+	}
+	else StartRangeOutput(out,0,0);
+	
+	uint64_t out_lines = 0;
+	bool error = false;
+	
+	/* write a line from file 1 that was not paired if needed */
+	auto finish1 = [&](const parsed_line& pl, bool matched) {
+		if(matched) in1.matched++;
+		else if(unpaired1) {
+			if(out.write_unpaired(0,pl)) out_lines++;
+			in1.unmatched++;
+		}
+	};
+	/* store the current line from file 1 (if not done yet) */
+	auto split_cur = [&]() -> bool {
+		if(!cur_split) {
+			if(!in1.split(lines1[cur])) return false;
+			cur_split = true;
+		}
+		return true;
+	};
+	/* go to the next line in file 1; keep is true if the current line
+	 * should become the previous one (candidate for backward matches) */
+	auto advance1 = [&](bool keep) -> bool {
+		if(keep) {
+			if(have_prev) finish1(lines1[1-cur],prev_matched);
+			if(!split_cur()) return false;
+			cur = 1 - cur;
+			prev_id = in1.id;
+			prev_matched = cur_matched;
+			have_prev = true;
+		}
+		else if(cur_matched || unpaired1) {
+			if(!split_cur()) return false;
+			finish1(lines1[cur],cur_matched);
+		}
+		cur_split = false;
+		cur_matched = false;
+		return in1.next();
+	};
+	
+	if(!(in1.next() && in2.next())) error = true;
+	while(!error && in2.valid) {
+		const K& p = in2.id;
+		// advance file 1 until the first line after (backward, nearest) or
+		// not before (forward) the current line of file 2
+		while(in1.valid && (dir == ASOF_FORWARD ? in1.id < p : !(p < in1.id)))
+			if(!advance1(dir != ASOF_FORWARD)) { error = true; break; }
+		if(error) break;
+		
+		// select the match among the previous and next line
+		bool use_prev = dir != ASOF_FORWARD && have_prev && !(has_tol && prev_id < KeySub(p,tol));
+		bool use_cur = dir != ASOF_BACKWARD && in1.valid && !(has_tol && KeyAdd(p,tol) < in1.id);
+		if(use_prev && use_cur) {
+			if(KeySub(in1.id,p) < KeySub(p,prev_id)) use_prev = false;
+			else use_cur = false;
+		}
+		const parsed_line* match = 0;
+		if(use_prev) {
+			match = &lines1[1-cur];
+			prev_matched = true;
+		}
+		else if(use_cur) {
+			if(!split_cur()) { error = true; break; }
+			match = &lines1[cur];
+			cur_matched = true;
+		}
+		
+		if(match || unpaired2) if(!in2.split(tmp2)) { error = true; break; }
+		if(match) {
+			in2.matched++;
+			if(!opt.only_unpaired) {
+				WriteRangeLine(out,match,&tmp2);
+				out_lines++;
+			}
+		}
+		else if(unpaired2) {
+			if(out.write_unpaired(1,tmp2)) out_lines++;
+			in2.unmatched++;
+		}
+		if(!in2.next()) error = true;
+	}
+	
+	if(!error) {
+		if(have_prev) finish1(lines1[1-cur],prev_matched);
+		if(unpaired1) { while(in1.valid) if(!advance1(false)) { error = true; break; } }
+		else if(in1.valid && cur_matched) in1.matched++;
+	}
+	
+	if(!out.finish()) error = true;
+	
+	std::cerr<<"Matched lines from file 1: "<<in1.matched<<'\n';
+	std::cerr<<"Matched lines from file 2: "<<in2.matched<<'\n';
+	if(in1.unmatched > 0) std::cerr<<"Unmatched lines from file 1: "<<in1.unmatched<<'\n';
+	if(in2.unmatched > 0) std::cerr<<"Unmatched lines from file 2: "<<in2.unmatched<<'\n';
+	std::cerr<<"Total lines output: "<<out_lines<<'\n';
+	return error ? 1 : 0;
+}
+
+/*
+ * range joins (only for two files and keys with a single numeric field):
+ * parse the parameter given on the command line and run the join
+ */
+template<class K>
+static int JoinRange(const join_options& opt, std::vector<std::vector<std::string> >& input_files) {
+	if(opt.range == join_options::RANGE_INTERVAL) {
+		key_spec end_ks;
+		std::vector<std::string> names;
+		if(!end_ks.set_fields(opt.range_arg.c_str(),names) || end_ks.fields.size() > 1 || end_ks.fields[0] < 1) {
+			std::cerr<<"Invalid field: "<<opt.range_arg<<"\n  use numjoin -h for help\n";
+			return 1;
+		}
+		end_ks.digits = opt.keys[0].digits;
+		temp_files tmp;
+		if(!SortInputs<K>(opt,input_files,tmp)) return 1;
+		return JoinInterval<K>(opt,input_files,end_ks);
+	}
+	
+	std::string arg = opt.range_arg;
+	asof_direction dir = ASOF_BACKWARD;
+	bool has_dist = true;
+	if(opt.range == join_options::RANGE_ASOF) {
+		size_t i = arg.find(':');
+		std::string d = arg.substr(0,i);
+		if(d == "backward") dir = ASOF_BACKWARD;
+		else if(d == "forward") dir = ASOF_FORWARD;
+		else if(d == "nearest") dir = ASOF_NEAREST;
+		else {
+			std::cerr<<"Invalid direction: "<<d<<"\n  use numjoin -h for help\n";
+			return 1;
+		}
+		has_dist = i != std::string::npos;
+		arg = has_dist ? arg.substr(i+1) : std::string();
+	}
+	
+	K dist = K();
+	if(has_dist) {
+		line_parser lp(arg.c_str());
+		if(!(ParseKey(lp,opt.keys[0],dist) && !(dist < K()))) {
+			std::cerr<<"Invalid distance: "<<arg<<"\n  use numjoin -h for help\n";
+			return 1;
+		}
+	}
+	temp_files tmp;
+	if(!SortInputs<K>(opt,input_files,tmp)) return 1;
+	if(opt.range == join_options::RANGE_ASOF) return JoinAsof<K>(opt,input_files,dir,has_dist,dist);
+	return JoinBand<K>(opt,input_files,dist);
+}
+
+/* join files, using the two file or multiple file version as needed */
+template<class K>
+static int Join(const join_options& opt, std::vector<std::vector<std::string> >& input_files) {
+	temp_files tmp;
+	if(!SortInputs<K>(opt,input_files,tmp)) return 1;
+	size_t n_unpaired = 0;
+	for(size_t j=0;j<input_files.size();j++) if(opt.need_unpaired(j)) n_unpaired++;
+	if(input_files.size() > 2 || n_unpaired > 1) return JoinMultiple<K>(opt,input_files);
+	return JoinTwo<K>(opt,input_files);
+}
+
+/* join files with keys of the given type, using composite keys if needed */
+template<class T>
+static int JoinKeyType(const join_options& opt, std::vector<std::vector<std::string> >& input_files) {
+	if(opt.keys[0].fields.size() > 1) return Join<key_tuple<T> >(opt,input_files);
+	return Join<T>(opt,input_files);
+}
+
+
+int main(int argc, char** args) {
+	join_options opt;
+	key_spec default_key(1);
+	std::vector<key_spec> keys; // join fields given explicitly for each file
+	std::vector<std::string> field_names; // fields given by name (for JSON input)
+	enum { KEY_INT, KEY_UINT, KEY_DOUBLE, KEY_FIXED, KEY_TIME, KEY_STRING } key_type = KEY_INT;
+	unsigned int digits = 0;
+	
+	// process option arguments
+	int i=1;
+	for(;i<argc;i++) if(args[i][0] == '-' && args[i][1] != 0) switch(args[i][1]) {
+		case '1':
+		case '2':
+		case '3':
+		case '4':
+		case '5':
+		case '6':
+		case '7':
+		case '8':
+		case '9':
+			{
+				int n = atoi(args[i]+1);
+				if(n < 1) { std::cerr<<"Invalid parameter: "<<args[i]<<"\n  use numjoin -h for help\n"; return 1; }
+				if(keys.size() < (size_t)n) keys.resize(n);
+				if(!keys[n-1].set_fields(args[i+1],field_names)) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
+			}
+			i++;
+			break;
+		case 'j':
+			if(!default_key.set_fields(args[i+1],field_names)) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
+			for(key_spec& ks : keys) ks = default_key;
+			i++;
+			break;
+		case 'k':
+			if(!strcmp(args[i+1],"int")) key_type = KEY_INT;
+			else if(!strcmp(args[i+1],"uint")) key_type = KEY_UINT;
+			else if(!strcmp(args[i+1],"double")) key_type = KEY_DOUBLE;
+			else if(!strcmp(args[i+1],"time")) key_type = KEY_TIME;
+			else if(!strcmp(args[i+1],"string")) key_type = KEY_STRING;
+			else if(!strncmp(args[i+1],"decimal:",8)) {
+				line_parser lp(args[i+1]+8);
+				if(!(lp.read(read_bounds(digits,0U,18U)))) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
+				key_type = KEY_FIXED;
+			}
+			else { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
+			i++;
+			break;
+		case 't':
+			opt.delim = args[i+1][0];
+			i++;
+			break;
+		case 'C':
+			opt.comment = args[i+1][0];
+			i++;
+			break;
+		case 'q':
+			opt.quote = '"';
+			break;
+		case 'J':
+			{
+				int n = atoi(args[i+1]);
+				if(n < 1) { std::cerr<<args[i]<<" parameter has to be a file number\n  use numjoin -h for help\n"; return 1; }
+				if(opt.json.size() < (size_t)n) opt.json.resize(n,false);
+				opt.json[n-1] = true;
+			}
+			i++;
+			break;
+		case 'w':
+			{
+				int n = atoi(args[i] + 2);
+				if(n < 1) { std::cerr<<"Invalid parameter: "<<args[i]<<"\n  (use -w1, -w2 or -wN for file N)\n  use numjoin -h for help\n"; return 1; }
+				if(opt.widths.size() < (size_t)n) { opt.widths.resize(n); opt.record_len.resize(n,0); }
+				if(!read_table2::parse_widths(args[i+1],opt.widths[n-1],opt.record_len[n-1])) {
+					std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n";
+					return 1;
+				}
+			}
+			i++;
+			break;
+/*		case 'e':
+			empty = args[i+1];
+			i++;
+			break; */
+		case 'a':
+		case 'v':
+			{
+				int n = atoi(args[i+1]);
+				if(n < 1) { std::cerr<<args[i]<<" parameter has to be a file number (1 or 2)\n  use numjoin -h for help\n"; return 1; }
+				if(opt.unpaired_files.size() < (size_t)n) opt.unpaired_files.resize(n,false);
+				opt.unpaired_files[n-1] = true;
+				if(args[i][1] == 'v') opt.only_unpaired = true;
+			}
+			i++;
+			break;
+		case 'o':
+			{
+				int n = atoi(args[i]+2);
+				if(n < 1) { std::cerr<<"Invalid parameter: "<<args[i]<<"\n  (use -o1, -o2 or -oN for file N)\n  use numjoin -h for help\n"; return 1; }
+				std::vector<int> tmp;
+				bool valid = true;
+				bool empty = true;
+				int max = 0;
+				// it is valid to give zero output columns from one of the files
+				// (e.g. to filter the other file)
+				// this case it might be necessary to give an empty string
+				// as the argument (i.e. -o1 "")
+				if( !(args[i+1] == 0 || args[i+1][0] == 0 || args[i+1][0] == '-') ) {
+					valid = ParseFieldList(args[i+1],tmp,field_names);
+					for(int x : tmp) if(x > max) max = x;
+					empty = false;
+				}
+				if(!valid) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
+				if(opt.outfields.size() < (size_t)n) {
+					opt.outfields.resize(n);
+					opt.outfields_empty.resize(n,false);
+					opt.req_fields.resize(n,1);
+				}
+				opt.outfields[n-1] = std::move(tmp);
+				opt.req_fields[n-1] = max > 1 ? max : 1;
+				opt.outfields_empty[n-1] = empty;
+				if(!(args[i+1] == 0 || args[i+1][0] == '-')) i++;
+			}
+			break;
+		case 'O':
+			opt.out_fn = args[i+1];
+			i++;
+			break;
+		case 'p':
+			{
+				if(i + 2 >= argc) { std::cerr<<args[i]<<" needs two parameters\n  use numjoin -h for help\n"; return 1; }
+				line_parser lp(args[i+1]);
+				if(!(lp.read(read_bounds(opt.partitions,1U,65536U)) && strstr(args[i+2],"%d"))) {
+					std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<" "<<args[i+2]<<"\n  use numjoin -h for help\n";
+					return 1;
+				}
+				opt.partition_pattern = args[i+2];
+			}
+			i += 2;
+			break;
+		case 'U':
+		case 'P':
+			{
+				int n = atoi(args[i]+2);
+				if(n < 1) { std::cerr<<"Invalid parameter: "<<args[i]<<"\n  (use "<<args[i][1]<<"1, "<<args[i][1]<<"2 or "<<args[i][1]<<"N for file N)\n  use numjoin -h for help\n"; return 1; }
+				if(opt.unpaired_fns.size() < (size_t)n) {
+					opt.unpaired_fns.resize(n);
+					opt.unpaired_fields.resize(n);
+				}
+				if(args[i][1] == 'U') opt.unpaired_fns[n-1] = args[i+1];
+				else if(!ParseFieldList(args[i+1],opt.unpaired_fields[n-1],field_names)) {
+					std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n";
+					return 1;
+				}
+			}
+			i++;
+			break;
+		case 'A':
+			opt.range = join_options::RANGE_ASOF;
+			opt.range_arg = args[i+1];
+			i++;
+			break;
+		case 'B':
+			opt.range = join_options::RANGE_BAND;
+			opt.range_arg = args[i+1];
+			i++;
+			break;
+		case 'I':
+			opt.range = join_options::RANGE_INTERVAL;
+			opt.range_arg = args[i+1];
+			i++;
+			break;
+		case 'S':
+			opt.sort_input = true;
+			break;
+		case 'W':
+			opt.async_output = true;
+			break;
+		case 'Z':
+			if(!write_buffer::parse_compression(args[i+1],opt.compress,opt.compress_level)) {
+				std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n";
+				return 1;
+			}
+			if(!write_buffer::compression_supported(opt.compress)) {
+				std::cerr<<"Error: "<<args[i+1]<<" compression is not supported in this build\n";
+				return 1;
+			}
+			i++;
+			break;
+		case 'f':
+			opt.arrow = !strcmp(args[i+1],"arrow");
+			opt.binary = !strcmp(args[i+1],"bin");
+			if(!(opt.arrow || opt.binary || !strcmp(args[i+1],"tsv"))) {
+				std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n";
+				return 1;
+			}
+			i++;
+			break;
+		case 'H':
+			opt.header = true;
+			break;
+		case 'c':
+			opt.strict_order = true;
+			break;
+		case 'm':
+			{
+				line_parser lp(args[i+1]);
+				uint32_t x;
+				if(!(lp.read(x) && x > 0)) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use numjoin -h for help\n"; return 1; }
+				opt.max_mem = x * 1048576UL;
+			}
+			i++;
+			break;
+		case 'h':
+			std::cout<<usage;
+			return 0;
+		default:
+			std::cerr<<"Unknown parameter: "<<args[i]<<"\n  use numjoin -h for help\n";
+			return 1;
+	}
+	else break; // non-option argument, means the filenames
+	// i now points to the first filename
+	if(i + 1 >= argc) { std::cerr<<"Error: expecting at least two input filenames\n  use numjoin -h for help\n"; return 1; }
+	size_t nfiles = argc - i;
+	int nstdin = 0;
+	for(size_t j=0;j<nfiles;j++) {
+		if(args[i+j][0] == '-' && args[i+j][1] == 0) nstdin++;
+		for(size_t k=0;k<j;k++) if(!strcmp(args[i+j],args[i+k])) { std::cerr<<"Error: input files have to be different!\n"; return 1; }
+	}
+	if(nstdin > 1) { std::cerr<<"Error: only one input file can be read from stdin!\n"; return 1; }
+	if(keys.size() > nfiles || opt.outfields.size() > nfiles || opt.unpaired_files.size() > nfiles ||
+			opt.unpaired_fns.size() > nfiles || opt.json.size() > nfiles || opt.widths.size() > nfiles) {
+		std::cerr<<"Error: options given for more files than the number of inputs!\n  use numjoin -h for help\n";
+		return 1;
+	}
+	keys.resize(nfiles);
+	for(key_spec& ks : keys) {
+		if(ks.fields.empty()) ks = default_key;
+		if(ks.fields.size() != keys[0].fields.size()) {
+			std::cerr<<"Error: the join key has to consist of the same number of fields in all files!\n";
+			return 1;
+		}
+		ks.digits = digits;
+	}
+	opt.keys = std::move(keys);
+	opt.outfields.resize(nfiles);
+	opt.outfields_empty.resize(nfiles,false);
+	opt.unpaired_fields.resize(nfiles);
+	// fields of JSON input are given by name, these are the members
+	// extracted from each line (fields of the converted lines)
+	opt.json.resize(nfiles,false);
+	opt.json_keys.resize(nfiles);
+	opt.widths.resize(nfiles);
+	opt.record_len.resize(nfiles,0);
+	opt.req_fields.assign(nfiles,1);
+	for(size_t j=0;j<nfiles;j++) {
+		if(opt.json[j] && opt.widths[j].size()) {
+			std::cerr<<"Error: -J "<<j+1<<" and -w"<<j+1<<" cannot be used together!\n  use numjoin -h for help\n";
+			return 1;
+		}
+		if(!(ResolveFieldNames(opt.keys[j].fields,field_names,opt.json[j],opt.json_keys[j]) &&
+				ResolveFieldNames(opt.outfields[j],field_names,opt.json[j],opt.json_keys[j]) &&
+				ResolveFieldNames(opt.unpaired_fields[j],field_names,opt.json[j],opt.json_keys[j]))) {
+			std::cerr<<"Error: fields of file "<<j+1<<" have to be given "<<(opt.json[j] ? "by name (JSON input)" :
+				"by number (names can only be used for JSON input, see -J)")<<"!\n  use numjoin -h for help\n";
+			return 1;
+		}
+		opt.keys[j].set_order();
+		for(int x : opt.outfields[j]) if(x > opt.req_fields[j]) opt.req_fields[j] = x;
+		if(opt.widths[j].size()) {
+			// fixed-width input has exactly the fields given
+			int max = opt.req_fields[j];
+			for(int x : opt.keys[j].fields) if(x > max) max = x;
+			for(int x : opt.unpaired_fields[j]) if(x > max) max = x;
+			if((size_t)max > opt.widths[j].size()) {
+				std::cerr<<"Error: file "<<j+1<<" has only "<<opt.widths[j].size()<<" fields (-w"<<j+1<<")!\n  use numjoin -h for help\n";
+				return 1;
+			}
+		}
+	}
+	if(opt.range == join_options::RANGE_INTERVAL && opt.json[0]) {
+		// end of intervals given by name as well
+		std::vector<int> tmp;
+		if(!(ParseFieldList(opt.range_arg.c_str(),tmp,field_names) && tmp.size() == 1 &&
+				ResolveFieldNames(tmp,field_names,true,opt.json_keys[0]))) {
+			std::cerr<<"Invalid parameter: -I "<<opt.range_arg<<"\n  use numjoin -h for help\n";
+			return 1;
+		}
+		opt.range_arg = std::to_string(tmp[0]);
+	}
+	// consecutive output fields can be copied at once if they are
+	// separated by one character in the input, which is used in the output;
+	// if all fields are written, the original line can be copied if there
+	// are no comments in it (not with -f arrow, which needs all fields split)
+	// with -q, fields are written one by one, quoted if needed; lines
+	// converted from JSON or fixed-width input have fields separated by tabs
+	if(opt.quote && !opt.delim) opt.delim = ',';
+	char out_sep = opt.delim ? opt.delim : '\t';
+	auto merge_fields = [&opt,out_sep](size_t j) { return opt.converted(j) ? out_sep == '\t' : opt.delim != 0; };
+	auto whole_line = [&opt,&merge_fields](size_t j) { return merge_fields(j) && (opt.converted(j) || opt.comment == 0); };
+	for(size_t j=0;j<nfiles;j++)
+		opt.plans.emplace_back(opt.outfields[j],opt.outfields_empty[j],out_sep,
+			merge_fields(j),whole_line(j) && !opt.arrow && !opt.binary,opt.quote);
+	opt.unpaired_files.resize(nfiles,false);
+	// separate files for unpaired lines: the whole line is written by default
+	opt.unpaired_fns.resize(nfiles);
+	opt.unpaired_fields.resize(nfiles);
+	for(size_t j=0;j<nfiles;j++) {
+		if(opt.unpaired_fields[j].size() && opt.unpaired_fns[j].empty()) {
+			std::cerr<<"Error: -P"<<j+1<<" given without -U"<<j+1<<"!\n  use numjoin -h for help\n";
+			return 1;
+		}
+		for(int x : opt.unpaired_fields[j]) if(x > opt.req_fields[j]) opt.req_fields[j] = x;
+		opt.unpaired_plans.emplace_back(opt.unpaired_fields[j],false,out_sep,
+			merge_fields(j),whole_line(j),opt.quote);
+	}
+	
+	// each argument can be a list of sorted files that are merged
+	std::vector<std::vector<std::string> > input_files(nfiles);
+	for(size_t j=0;j<nfiles;j++) {
+		if(!ExpandInput(args[i+j],input_files[j])) return 1;
+		if(input_files[j].size() > 1) for(const std::string& fn : input_files[j])
+			if(fn == "-") { std::cerr<<"Error: stdin cannot be part of a list of input files!\n"; return 1; }
+	}
+	
+	if(opt.partitions && opt.out_fn.size()) {
+		std::cerr<<"Error: -O and -p cannot be used together!\n  use numjoin -h for help\n";
+		return 1;
+	}
+	
+	if(opt.binary && opt.partitions) {
+		std::cerr<<"Error: -f bin and -p cannot be used together!\n  use numjoin -h for help\n";
+		return 1;
+	}
+	if(opt.arrow) {
+		if(opt.partitions) {
+			std::cerr<<"Error: -f arrow and -p cannot be used together!\n  use numjoin -h for help\n";
+			return 1;
+		}
+		// the columns of the output have to be known in advance
+		if(!opt.header) for(size_t j=0;j<nfiles;j++) if(opt.outfields[j].empty() && !opt.outfields_empty[j] && !opt.converted(j)) {
+			std::cerr<<"Error: -f arrow needs the output fields (-o"<<j+1<<") or a header (-H)!\n  use numjoin -h for help\n";
+			return 1;
+		}
+		switch(key_type) {
+			case KEY_UINT:
+				opt.arrow_key_type = arrow_writer::ARROW_UINT64;
+				break;
+			case KEY_DOUBLE:
+				opt.arrow_key_type = arrow_writer::ARROW_DOUBLE;
+				break;
+			case KEY_FIXED:
+				opt.arrow_key_type = arrow_writer::ARROW_DECIMAL;
+				break;
+			case KEY_TIME:
+				opt.arrow_key_type = arrow_writer::ARROW_TIMESTAMP;
+				break;
+			case KEY_STRING:
+				opt.arrow_key_type = arrow_writer::ARROW_UTF8;
+				break;
+			default:
+				opt.arrow_key_type = arrow_writer::ARROW_INT64;
+				break;
+		}
+	}
+	
+	if(opt.range != join_options::RANGE_NONE) {
+		if(opt.partitions) {
+			std::cerr<<"Error: partitioning the output (-p) is not supported for range joins!\n";
+			return 1;
+		}
+		if(nfiles != 2 || opt.keys[0].fields.size() > 1 || key_type == KEY_STRING) {
+			std::cerr<<"Error: range joins are only supported for two files and a single numeric or time join field!\n";
+			return 1;
+		}
+		switch(key_type) {
+			case KEY_UINT:
+				return JoinRange<uint64_t>(opt,input_files);
+			case KEY_DOUBLE:
+				return JoinRange<double>(opt,input_files);
+			case KEY_FIXED:
+				return JoinRange<fixed_point>(opt,input_files);
+			case KEY_TIME:
+				return JoinRange<timestamp>(opt,input_files);
+			default:
+				return JoinRange<int64_t>(opt,input_files);
+		}
+	}
+	
+	switch(key_type) {
+		case KEY_UINT:
+			return JoinKeyType<uint64_t>(opt,input_files);
+		case KEY_DOUBLE:
+			return JoinKeyType<double>(opt,input_files);
+		case KEY_FIXED:
+			return JoinKeyType<fixed_point>(opt,input_files);
+		case KEY_TIME:
+			return JoinKeyType<timestamp>(opt,input_files);
+		case KEY_STRING:
+			return JoinKeyType<string_key>(opt,input_files);
+		default:
+			return JoinKeyType<int64_t>(opt,input_files);
+	}
+}
 
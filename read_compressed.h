@@ -0,0 +1,645 @@
+/*  -*- C++ -*-
+ * read_compressed.h -- transparent decompression of input streams
+ *
+ * decompress_buf is a stream buffer that reads compressed data from another
+ * stream buffer and provides the decompressed data; the format is detected
+ * from the first bytes of the input (gzip or zstd, data in other formats is
+ * passed through unchanged)
+ *
+ * decompression runs in a separate thread, so that it can proceed while the
+ * data is processed; files in the BGZF format (gzip files consisting of
+ * blocks of at most 64 kiB with their sizes given in the header, e.g. as
+ * created by bgzip) and zstd files in the seekable format (the seek table at
+ * the end gives the size of each frame) are decompressed in parallel by
+ * multiple threads; other gzip and zstd files (including ones with multiple
+ * members or frames) are decompressed sequentially
+ *
+ * random access (seekg() / tellg() on a stream using decompress_buf) is
+ * supported if the underlying stream is seekable and the input is in the
+ * BGZF format (positions are virtual offsets: the offset of the compressed
+ * block shifted left by 16 bits plus the offset in the decompressed block)
+ * or in the zstd seekable format (positions are offsets in the decompressed
+ * data, the frame containing them is found using the seek table stored at
+ * the end of the file); only the blocks or frames after the new position
+ * are decompressed
+ *
+ * gzip support requires zlib (link with -lz, or define NO_ZLIB to compile
+ * without it), zstd support requires libzstd and is enabled by defining
+ * HAVE_ZSTD (link with -lzstd)
+ *
+ * Copyright 2018 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * example usage in C++
+
+std::ifstream f(fn,std::ios::binary);
+if(decompress_buf::is_compressed(f)) {
+	decompress_buf db(f.rdbuf());
+	if(!db.start()) { ... } // handle error
+	std::istream is(&db);
+	... // read decompressed data from is
+	if(db.failed()) { ... } // handle error, see db.get_error()
+}
+
+ */
+
+#ifndef _READ_COMPRESSED_H
+#define _READ_COMPRESSED_H
+
+#include <stdint.h>
+#include <string.h>
+#include <streambuf>
+#include <istream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+class decompress_buf : public std::streambuf {
+	public:
+		enum format { FORMAT_NONE, FORMAT_GZIP, FORMAT_BGZF, FORMAT_ZSTD };
+
+	protected:
+		/* block of data: compressed input (if decompressed by a worker
+		 * thread) and decompressed output */
+		struct block {
+			std::vector<char> in;
+			std::vector<char> out;
+			/* BGZF blocks or zstd frames: compressed offset of each and the
+			 * start of its data in out; the last element is the end of the
+			 * last block */
+			std::vector<std::pair<uint64_t,size_t> > members;
+			bool taken; /* a worker thread is decompressing this block */
+			bool done; /* output is ready */
+			const char* err; /* error message or NULL */
+			block():taken(true),done(true),err(0) { }
+		};
+
+		std::streambuf* src; /* compressed input */
+		format fmt;
+
+		/* input buffer (used by the reader thread only) */
+		std::vector<char> inbuf;
+		size_t inpos; /* start of unprocessed data in inbuf */
+		size_t inlen; /* end of data in inbuf */
+		uint64_t inbase; /* offset of inbuf[0] in the input */
+
+		std::vector<char> cur; /* current block of output */
+		std::vector<std::pair<uint64_t,size_t> > cur_members; /* BGZF blocks in cur */
+		uint64_t cur_pos; /* decompressed offset of the start of cur */
+		uint64_t next_pos; /* decompressed offset of the next block */
+		uint64_t start_pos; /* position after the last seek (returned by tellg() before reading) */
+		size_t skip; /* bytes to skip after seeking to the start of a block */
+		/* seek table of a zstd seekable file: compressed and decompressed
+		 * offsets of the start of each frame (and the end of the last one) */
+		std::vector<std::pair<uint64_t,uint64_t> > seek_table;
+		bool src_seekable; /* the input supports seeking */
+
+		std::thread reader; /* reads and decompresses input */
+		std::vector<std::thread> workers; /* decompress blocks in parallel */
+		std::mutex m;
+		std::condition_variable cv; /* signaled if the queue changes */
+		std::deque<block> queue; /* blocks of output in order */
+		size_t max_queue;
+		bool stop; /* set by the destructor to stop all threads */
+		bool reader_done; /* the reader thread finished */
+		bool failed_;
+		const char* err;
+
+		static const size_t chunk_size = 1048576; /* size of output blocks */
+
+		/* move unprocessed data to the start of inbuf and read more after it;
+		 * returns false if no more data could be read */
+		bool refill() {
+			if(inpos) {
+				memmove(inbuf.data(),inbuf.data() + inpos,inlen - inpos);
+				inlen -= inpos;
+				inbase += inpos;
+				inpos = 0;
+			}
+			if(inbuf.size() - inlen < chunk_size) inbuf.resize(inlen + chunk_size);
+			std::streamsize r = src->sgetn(inbuf.data() + inlen,inbuf.size() - inlen);
+			if(r <= 0) return false;
+			inlen += r;
+			return true;
+		}
+		/* make sure that at least n bytes of input are available */
+		bool fill(size_t n) {
+			while(inlen - inpos < n) if(!refill()) return false;
+			return true;
+		}
+
+		/* add a block to the end of the queue, wait if it is full; returns
+		 * false if the reader thread should stop */
+		bool push(block&& b) {
+			std::unique_lock<std::mutex> lock(m);
+			while(queue.size() >= max_queue && !stop) cv.wait(lock);
+			if(stop) return false;
+			queue.push_back(std::move(b));
+			cv.notify_all();
+			return true;
+		}
+
+		/* pass on data from the input without changes */
+		bool read_plain() {
+			while(true) {
+				block b;
+				if(inlen > inpos) {
+					b.out.assign(inbuf.data() + inpos,inbuf.data() + inlen);
+					inpos = inlen;
+				}
+				else {
+					b.out.resize(chunk_size);
+					std::streamsize r = src->sgetn(b.out.data(),b.out.size());
+					if(r <= 0) return true;
+					b.out.resize(r);
+				}
+				if(!push(std::move(b))) return true;
+			}
+		}
+
+		/* worker thread: decompress blocks in the queue that are not done */
+		void run_worker() {
+#ifndef NO_ZLIB
+			z_stream zs;
+			memset(&zs,0,sizeof(zs));
+			bool zinit = (fmt != FORMAT_ZSTD && inflateInit2(&zs,-15) == Z_OK);
+#endif
+#ifdef HAVE_ZSTD
+			ZSTD_DCtx* dctx = (fmt == FORMAT_ZSTD) ? ZSTD_createDCtx() : 0;
+#endif
+			std::unique_lock<std::mutex> lock(m);
+			while(true) {
+				block* b = 0;
+				while(true) {
+					for(block& x : queue) if(!x.taken) { b = &x; break; }
+					if(b || stop || reader_done) break;
+					cv.wait(lock);
+				}
+				if(!b) break;
+				b->taken = true;
+				lock.unlock();
+				const char* e = "Error decompressing input";
+#ifndef NO_ZLIB
+				if(zinit) e = decompress_bgzf(*b,zs);
+#endif
+#ifdef HAVE_ZSTD
+				if(dctx) e = decompress_zstd(*b,dctx);
+#endif
+				std::vector<char>().swap(b->in);
+				lock.lock();
+				b->err = e;
+				b->done = true;
+				cv.notify_all();
+			}
+#ifndef NO_ZLIB
+			if(zinit) inflateEnd(&zs);
+#endif
+#ifdef HAVE_ZSTD
+			if(dctx) ZSTD_freeDCtx(dctx);
+#endif
+		}
+		/* start the worker threads (if not running yet) */
+		void start_workers() {
+			if(workers.size()) return;
+			unsigned int nthreads = std::thread::hardware_concurrency();
+			if(nthreads < 1) nthreads = 1;
+			std::unique_lock<std::mutex> lock(m);
+			max_queue = 2*nthreads + 2;
+			for(unsigned int i=0;i<nthreads;i++) workers.emplace_back(&decompress_buf::run_worker,this);
+		}
+
+#ifndef NO_ZLIB
+		static uint32_t get_le(const char* c, unsigned int n) {
+			uint32_t x = 0;
+			for(unsigned int i=0;i<n;i++) x |= ((uint32_t)(unsigned char)c[i]) << (8*i);
+			return x;
+		}
+		/* check if a BGZF block starts at c (at least 18 bytes available);
+		 * returns its size or 0 if it is not a BGZF block */
+		static size_t bgzf_block_size(const char* c) {
+			if(!((unsigned char)c[0] == 0x1f && (unsigned char)c[1] == 0x8b && c[2] == 8 && (c[3] & 4))) return 0;
+			if(!(get_le(c+10,2) == 6 && c[12] == 'B' && c[13] == 'C' && get_le(c+14,2) == 2)) return 0;
+			return get_le(c+16,2) + 1;
+		}
+
+		/* decompress the BGZF blocks in b.in (done by a worker thread) */
+		static const char* decompress_bgzf(block& b, z_stream& zs) {
+			size_t total = 0;
+			for(size_t p = 0; p < b.in.size(); p += bgzf_block_size(b.in.data() + p))
+				total += get_le(b.in.data() + p + bgzf_block_size(b.in.data() + p) - 4,4);
+			b.out.resize(total);
+			size_t outpos = 0;
+			for(size_t p = 0; p < b.in.size(); ) {
+				const char* c = b.in.data() + p;
+				size_t bsize = bgzf_block_size(c);
+				size_t isize = get_le(c + bsize - 4,4);
+				if(inflateReset(&zs) != Z_OK) return "Error decompressing input";
+				zs.next_in = (Bytef*)(c + 18);
+				zs.avail_in = bsize - 26;
+				/* empty blocks (e.g. the EOF marker) have no output space;
+				 * inflate() still needs a valid pointer */
+				char dummy;
+				zs.next_out = isize ? (Bytef*)(b.out.data() + outpos) : (Bytef*)&dummy;
+				zs.avail_out = isize ? isize : 1;
+				int r = inflate(&zs,Z_FINISH);
+				if(r != Z_STREAM_END || zs.total_out != isize) return "Invalid compressed data";
+				if(crc32(0,(const Bytef*)(b.out.data() + outpos),isize) != get_le(c + bsize - 8,4))
+					return "Invalid checksum in compressed data";
+				outpos += isize;
+				p += bsize;
+			}
+			return 0;
+		}
+
+		/* read BGZF blocks (starting at inpos) in chunks and queue them to be
+		 * decompressed in parallel; stops at the first member that is not a
+		 * BGZF block */
+		const char* read_bgzf() {
+			start_workers();
+			while(true) {
+				block b;
+				b.taken = false;
+				b.done = false;
+				size_t outlen = 0;
+				while(b.in.size() < chunk_size && fill(18)) {
+					size_t bsize = bgzf_block_size(inbuf.data() + inpos);
+					if(bsize < 26) break;
+					if(!fill(bsize)) return "Unexpected end of compressed data";
+					b.members.push_back(std::make_pair(inbase + inpos,outlen));
+					outlen += get_le(inbuf.data() + inpos + bsize - 4,4);
+					b.in.insert(b.in.end(),inbuf.data() + inpos,inbuf.data() + inpos + bsize);
+					inpos += bsize;
+				}
+				if(b.in.empty()) return 0;
+				b.members.push_back(std::make_pair(inbase + inpos,outlen));
+				if(!push(std::move(b))) return 0;
+			}
+		}
+
+		/* decompress gzip data, possibly consisting of multiple members */
+		const char* read_gzip() {
+			z_stream zs;
+			memset(&zs,0,sizeof(zs));
+			if(inflateInit2(&zs,15+16) != Z_OK) return "Error decompressing input";
+			const char* e = 0;
+			block b;
+			while(!e) {
+				/* start of a member */
+				if(!fill(1)) break;
+				if(fill(18) && bgzf_block_size(inbuf.data() + inpos) >= 26) {
+					if(b.out.size() && !push(std::move(b))) break;
+					b = block();
+					e = read_bgzf();
+					continue;
+				}
+				if(!fill(2) || !((unsigned char)inbuf[inpos] == 0x1f && (unsigned char)inbuf[inpos+1] == 0x8b)) {
+					e = "Invalid data after the end of compressed data";
+					break;
+				}
+				if(inflateReset(&zs) != Z_OK) { e = "Error decompressing input"; break; }
+				while(true) {
+					if(inpos == inlen && !refill()) { e = "Unexpected end of compressed data"; break; }
+					size_t outpos = b.out.size();
+					b.out.resize(outpos + chunk_size);
+					zs.next_in = (Bytef*)(inbuf.data() + inpos);
+					zs.avail_in = inlen - inpos;
+					zs.next_out = (Bytef*)(b.out.data() + outpos);
+					zs.avail_out = chunk_size;
+					int r = inflate(&zs,Z_NO_FLUSH);
+					inpos = inlen - zs.avail_in;
+					b.out.resize(outpos + chunk_size - zs.avail_out);
+					if(r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) { e = "Invalid compressed data"; break; }
+					if(b.out.size() >= chunk_size) {
+						if(!push(std::move(b))) { inflateEnd(&zs); return 0; }
+						b = block();
+					}
+					if(r == Z_STREAM_END) break;
+				}
+			}
+			inflateEnd(&zs);
+			if(!e && b.out.size()) push(std::move(b));
+			return e;
+		}
+#endif
+
+#ifdef HAVE_ZSTD
+		/* decompress zstd data (possibly consisting of multiple frames) */
+		const char* read_zstd() {
+			ZSTD_DStream* ds = ZSTD_createDStream();
+			if(!ds) return "Error decompressing input";
+			const char* e = 0;
+			size_t last = 0; /* zero at the end of a frame */
+			bool more = false; /* there might be more output without new input */
+			while(true) {
+				if(inpos == inlen && !more && !refill()) break;
+				block b;
+				b.out.resize(chunk_size);
+				ZSTD_inBuffer in = { inbuf.data(), inlen, inpos };
+				ZSTD_outBuffer out = { b.out.data(), b.out.size(), 0 };
+				do {
+					last = ZSTD_decompressStream(ds,&out,&in);
+					if(ZSTD_isError(last)) { e = "Invalid compressed data"; break; }
+				} while(out.pos < out.size && in.pos < in.size);
+				more = (out.pos == out.size);
+				inpos = in.pos;
+				if(e) break;
+				b.out.resize(out.pos);
+				if(b.out.size() && !push(std::move(b))) break;
+			}
+			if(!e && last) e = "Unexpected end of compressed data";
+			ZSTD_freeDStream(ds);
+			return e;
+		}
+
+		/* decompress the zstd frames in b.in (done by a worker thread) */
+		static const char* decompress_zstd(block& b, ZSTD_DCtx* dctx) {
+			b.out.resize(b.members.back().second);
+			for(size_t i=0;i+1<b.members.size();i++) {
+				const char* c = b.in.data() + (b.members[i].first - b.members[0].first);
+				size_t clen = b.members[i+1].first - b.members[i].first;
+				size_t dlen = b.members[i+1].second - b.members[i].second;
+				char dummy; /* frames without output still need a valid pointer */
+				char* d = dlen ? b.out.data() + b.members[i].second : &dummy;
+				size_t r = ZSTD_decompressDCtx(dctx,d,dlen,c,clen);
+				if(ZSTD_isError(r) || r != dlen) return "Invalid compressed data";
+			}
+			return 0;
+		}
+
+		/* read the frames of a zstd seekable file in chunks (using the
+		 * sizes in the seek table) and queue them to be decompressed in
+		 * parallel; falls back to read_zstd() if not at the start of a frame */
+		const char* read_zstd_frames() {
+			size_t i = 0;
+			while(i + 1 < seek_table.size() && seek_table[i].first < inbase + inpos) i++;
+			if(seek_table[i].first != inbase + inpos) return read_zstd();
+			start_workers();
+			while(i + 1 < seek_table.size()) {
+				block b;
+				b.taken = false;
+				b.done = false;
+				uint64_t dstart = seek_table[i].second;
+				do {
+					size_t clen = seek_table[i+1].first - seek_table[i].first;
+					if(!fill(clen)) return "Unexpected end of compressed data";
+					b.members.push_back(std::make_pair(seek_table[i].first,(size_t)(seek_table[i].second - dstart)));
+					b.in.insert(b.in.end(),inbuf.data() + inpos,inbuf.data() + inpos + clen);
+					inpos += clen;
+					i++;
+				} while(b.in.size() < chunk_size && i + 1 < seek_table.size());
+				b.members.push_back(std::make_pair(seek_table[i].first,(size_t)(seek_table[i].second - dstart)));
+				if(!push(std::move(b))) return 0;
+			}
+			return 0;
+		}
+#endif
+
+		/* reader thread */
+		void run_reader() {
+			const char* e = 0;
+			switch(fmt) {
+				case FORMAT_GZIP:
+				case FORMAT_BGZF:
+#ifndef NO_ZLIB
+					e = read_gzip();
+#else
+					e = "gzip input is not supported (compiled without zlib)";
+#endif
+					break;
+				case FORMAT_ZSTD:
+#ifdef HAVE_ZSTD
+					e = seek_table.size() ? read_zstd_frames() : read_zstd();
+#else
+					e = "zstd input is not supported (compiled without zstd support)";
+#endif
+					break;
+				default:
+					read_plain();
+					break;
+			}
+			std::unique_lock<std::mutex> lock(m);
+			if(e) {
+				block b;
+				b.err = e;
+				queue.push_back(std::move(b));
+			}
+			reader_done = true;
+			cv.notify_all();
+		}
+
+		int_type underflow() override {
+			if(gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			if(failed_) return traits_type::eof();
+			std::unique_lock<std::mutex> lock(m);
+			while(true) {
+				while(!(queue.size() && queue.front().done) && !(reader_done && queue.empty())) cv.wait(lock);
+				if(queue.empty()) return traits_type::eof();
+				block& b = queue.front();
+				if(b.err) {
+					failed_ = true;
+					err = b.err;
+					return traits_type::eof();
+				}
+				cur.swap(b.out);
+				cur_members.swap(b.members);
+				queue.pop_front();
+				cv.notify_all();
+				cur_pos = next_pos;
+				next_pos += cur.size();
+				size_t n = skip < cur.size() ? skip : cur.size();
+				skip -= n;
+				setg(cur.data(),cur.data() + n,cur.data() + cur.size());
+				if(gptr() < egptr()) break;
+			}
+			return traits_type::to_int_type(*gptr());
+		}
+
+		/* stop the reader and worker threads and discard any data read */
+		void stop_threads() {
+			{
+				std::unique_lock<std::mutex> lock(m);
+				stop = true;
+				cv.notify_all();
+			}
+			if(reader.joinable()) reader.join();
+			for(std::thread& t : workers) t.join();
+			workers.clear();
+			queue.clear();
+			stop = false;
+			reader_done = false;
+			max_queue = 4;
+			setg(0,0,0);
+			cur.clear();
+			cur_members.clear();
+			inpos = inlen = 0;
+		}
+		bool start_reader() {
+			try { reader = std::thread(&decompress_buf::run_reader,this); }
+			catch(...) { failed_ = true; err = "Cannot start decompression thread"; return false; }
+			return true;
+		}
+
+		/* read the seek table at the end of a zstd seekable file (if the
+		 * input is seekable and has one); the current position is kept */
+		void read_seek_table() {
+			std::streampos pos = src->pubseekoff(0,std::ios_base::cur,std::ios_base::in);
+			std::streampos end = src->pubseekoff(0,std::ios_base::end,std::ios_base::in);
+			if(pos == std::streampos(-1) || end == std::streampos(-1)) return;
+			char footer[9];
+			if(end >= 9 && src->pubseekpos(end - std::streamoff(9),std::ios_base::in) != std::streampos(-1) &&
+					src->sgetn(footer,9) == 9 && get_le32(footer+5) == 0x8F92EAB1U) {
+				uint64_t nframes = get_le32(footer);
+				size_t entry = (footer[4] & 0x80) ? 12 : 8;
+				uint64_t table = nframes*entry + 8 + 9; /* skippable frame header and footer */
+				std::vector<char> buf(nframes*entry);
+				if(table <= (uint64_t)end && src->pubseekpos(end - std::streamoff(table),std::ios_base::in) != std::streampos(-1)) {
+					char header[8];
+					if(src->sgetn(header,8) == 8 && get_le32(header) == 0x184D2A5EU &&
+							get_le32(header+4) == table - 8 && src->sgetn(buf.data(),buf.size()) == (std::streamsize)buf.size()) {
+						uint64_t c = 0, d = 0;
+						seek_table.push_back(std::make_pair(c,d));
+						for(uint64_t i=0;i<nframes;i++) {
+							c += get_le32(buf.data() + i*entry);
+							d += get_le32(buf.data() + i*entry + 4);
+							seek_table.push_back(std::make_pair(c,d));
+						}
+						if(c != (uint64_t)end - table) seek_table.clear();
+					}
+				}
+			}
+			src->pubseekpos(pos,std::ios_base::in);
+		}
+		static uint32_t get_le32(const char* c) {
+			uint32_t x = 0;
+			for(unsigned int i=0;i<4;i++) x |= ((uint32_t)(unsigned char)c[i]) << (8*i);
+			return x;
+		}
+
+		/* current position (see above), or -1 if not supported */
+		int64_t tell() const {
+			if(!seekable()) return -1;
+			if(!eback()) return start_pos;
+			size_t off = gptr() - eback();
+			if(fmt != FORMAT_BGZF) return cur_pos + off;
+			if(cur_members.size() < 2) return -1; /* not a BGZF block */
+			size_t i = 0;
+			while(i + 2 < cur_members.size() && cur_members[i+1].second <= off) i++;
+			if(cur_members[i+1].second == off) i++; /* end of a block: start of the next */
+			return (int64_t)((cur_members[i].first << 16) | (off - cur_members[i].second));
+		}
+		/* go to the given position (as returned by tell()) */
+		bool seek(int64_t pos) {
+			if(!seekable() || pos < 0) return false;
+			uint64_t coff;
+			uint64_t p = pos;
+			if(fmt == FORMAT_BGZF) {
+				coff = p >> 16;
+				skip = p & 0xffffU;
+			}
+			else {
+				size_t i = 1;
+				while(i + 1 < seek_table.size() && seek_table[i].second <= p) i++;
+				coff = seek_table[i-1].first;
+				if(p > seek_table[i].second) return false;
+				skip = p - seek_table[i-1].second;
+				next_pos = seek_table[i-1].second;
+			}
+			stop_threads();
+			failed_ = false;
+			err = 0;
+			if(src->pubseekpos(coff,std::ios_base::in) != std::streampos(coff)) {
+				failed_ = true;
+				err = "Cannot seek in the input";
+				return false;
+			}
+			inbase = coff;
+			start_pos = pos;
+			return start_reader();
+		}
+
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+			if(!(which & std::ios_base::in)) return pos_type(off_type(-1));
+			if(dir == std::ios_base::cur && off == 0) return pos_type(off_type(tell()));
+			if(dir == std::ios_base::beg && seek(off)) return pos_type(off);
+			return pos_type(off_type(-1));
+		}
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+			return seekoff(off_type(pos),std::ios_base::beg,which);
+		}
+
+	public:
+		explicit decompress_buf(std::streambuf* src_):src(src_),fmt(FORMAT_NONE),inpos(0),inlen(0),inbase(0),
+			cur_pos(0),next_pos(0),start_pos(0),skip(0),src_seekable(false),max_queue(4),stop(false),reader_done(false),
+			failed_(false),err(0) { }
+		~decompress_buf() { stop_threads(); }
+		decompress_buf(const decompress_buf&) = delete;
+		decompress_buf& operator = (const decompress_buf&) = delete;
+
+		/* check if the data in the given stream might be compressed
+		 * (without consuming any of it) */
+		static bool is_compressed(std::istream& is) {
+			int c = is.peek();
+			return c == 0x1f || c == 0x28;
+		}
+
+		/* detect the format of the input and start decompressing it;
+		 * returns false on error */
+		bool start() {
+			if(reader.joinable()) return false;
+			fill(4);
+			const unsigned char* c = (const unsigned char*)inbuf.data();
+			if(inlen >= 2 && c[0] == 0x1f && c[1] == 0x8b) fmt = FORMAT_GZIP;
+			else if(inlen >= 4 && c[0] == 0x28 && c[1] == 0xb5 && c[2] == 0x2f && c[3] == 0xfd) fmt = FORMAT_ZSTD;
+			else fmt = FORMAT_NONE;
+#ifndef NO_ZLIB
+			if(fmt == FORMAT_GZIP && fill(18) && bgzf_block_size(inbuf.data()) >= 26) fmt = FORMAT_BGZF;
+#endif
+			src_seekable = (src->pubseekoff(0,std::ios_base::cur,std::ios_base::in) != std::streampos(-1));
+			if(fmt == FORMAT_ZSTD && src_seekable) read_seek_table();
+			return start_reader();
+		}
+
+		format get_format() const { return fmt; }
+		/* true if random access is possible (BGZF or zstd seekable format;
+		 * the underlying stream needs to be seekable as well) */
+		bool seekable() const {
+			if(fmt == FORMAT_ZSTD) return seek_table.size() > 0;
+			return fmt == FORMAT_BGZF && src_seekable;
+		}
+		/* true if there was an error (and reading stopped because of it) */
+		bool failed() const { return failed_; }
+		/* description of the error */
+		const char* get_error() const { return err ? err : "No error"; }
+};
+
+#endif
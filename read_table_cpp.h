@@ -61,16 +61,22 @@ if(r.get_last_error() != T_EOF) { // handle error
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <limits.h>
 #include <ctype.h>
 #include <errno.h>
 #include <utility>
+#include <algorithm>
 #include <iostream>
 #include <istream>
 #include <ostream>
 #include <fstream>
 #include <string>
+#include <memory>
+#include "read_compressed.h"
+#include "binary_table.h"
+#include "json_lines.h"
 #if __cplusplus >= 201703L
 #include <string_view>
 #endif
@@ -82,11 +88,12 @@ static inline bool _isinf(double x) { return std::isinf(x); }
 
 /* possible error codes */
 enum read_table_errors {T_OK = 0, T_EOF = 1, T_EOL, T_MISSING, T_FORMAT,
-	T_OVERFLOW, T_NAN, T_TYPE, T_COPIED, T_ERROR_FOPEN, T_READ_ERROR};
+	T_OVERFLOW, T_NAN, T_TYPE, T_COPIED, T_ERROR_FOPEN, T_READ_ERROR, T_ERROR_DECOMPRESS,
+	T_ERROR_BINARY};
 static const char * const error_desc[] = {"No error", "End of file", "Unexpected end of line",
 		"Missing value", "Invalid value", "Overflow or underflow", "NaN or infinity read",
 		"Unknown conversion requested", "Invalidated instance", "Error opening file",
-		"Error reading input"};
+		"Error reading input", "Error decompressing input", "Error reading binary table"};
 
 /* convert error code to string description */
 static const char* get_error_desc(enum read_table_errors err) {
@@ -114,6 +121,10 @@ static const char* get_error_desc(enum read_table_errors err) {
 			return error_desc[9];
 		case T_READ_ERROR:
 			return error_desc[10];
+		case T_ERROR_DECOMPRESS:
+			return error_desc[11];
+		case T_ERROR_BINARY:
+			return error_desc[12];
 		default:
 			return unkn;
 	}
@@ -183,11 +194,29 @@ struct line_parser_params {
 	char delim; /* delimiter to use; 0 means any blank (space or tab) note: cannot be newline */
 	char comment; /* character to indicate comments; 0 means none */
 	bool allow_nan_inf; /* further flags: whether reading a NaN or INF for double values is considered and error */
-	line_parser_params():base(10),delim(0),comment(0),allow_nan_inf(true) { }
+	char quote; /* character used to quote fields as in CSV files (RFC 4180); 0 means none; requires a delimiter */
+	/* read_table2 only: the input is JSON Lines, each line is converted to the
+	 * values of these top-level members, separated by tabs (see json_lines.h);
+	 * the other parameters are ignored then; the pointer is stored */
+	const std::vector<std::string>* json_keys;
+	/* read_table2 only: fixed-width fields with these widths, converted to
+	 * tab-separated values as for JSON (the widths are copied); if
+	 * record_len is not zero, records have this length and are not
+	 * separated by newlines */
+	const std::vector<size_t>* widths;
+	size_t record_len;
+	line_parser_params():base(10),delim(0),comment(0),allow_nan_inf(true),quote(0),json_keys(0),widths(0),record_len(0) { }
 	line_parser_params& set_base(int base_) { base = base_; return *this; }
 	line_parser_params& set_delim(char delim_) { delim = delim_; return *this; }
 	line_parser_params& set_comment(char comment_) { comment = comment_; return *this; }
 	line_parser_params& set_allow_nan_inf(bool allow_nan_inf_) { allow_nan_inf = allow_nan_inf_; return *this; }
+	line_parser_params& set_quote(char quote_) { quote = quote_; return *this; }
+	line_parser_params& set_json_keys(const std::vector<std::string>* json_keys_) { json_keys = json_keys_; return *this; }
+	line_parser_params& set_widths(const std::vector<size_t>* widths_, size_t record_len_ = 0) {
+		widths = widths_;
+		record_len = record_len_;
+		return *this;
+	}
 };
 
 /* "helper" class doing most of the work for parsing only one line */
@@ -201,15 +230,85 @@ struct line_parser {
 		char delim; /* delimiter to use; 0 means any blank (space or tab) note: cannot be newline */
 		char comment; /* character to indicate comments; 0 means none */
 		bool allow_nan_inf; /* further flags: whether reading a NaN or INF for double values is considered and error */
+		char quote; /* quote character (CSV files), 0 if none */
+		bool quoted; /* the number being read started with a quote (set by read_table_pre_check()) */
+		/* start and length of the fields in buf if already known (when
+		 * reading a binary table or if fields can be quoted); fields are
+		 * separated by exactly one delimiter in this case, quoted fields
+		 * do not include the quotes (escaped quotes inside are kept as
+		 * two quote characters) */
+		bool have_known_fields;
+		std::vector<std::pair<size_t,size_t> > known_fields;
+		
+		/* return the next field from known_fields */
+		bool next_known_field(std::pair<size_t,size_t>& f) {
+			if(col >= known_fields.size()) { last_error = T_EOL; return false; }
+			f = known_fields[col++];
+			/* move after the delimiter (and the closing quote) */
+			size_t e = f.first + f.second;
+			if(quote && e < buf.size() && buf[e] == quote) e++;
+			pos = e < buf.size() ? e + 1 : buf.size();
+			last_error = T_OK;
+			return true;
+		}
+		
+		/* find the fields of a line that can contain quoted fields, starting
+		 * at position from in buf; a block of 64 characters is processed at
+		 * once: the position of quotes and delimiters are collected as bits,
+		 * a prefix XOR of the quote bits gives the characters inside quotes
+		 * (escaped quotes cancel out), so the delimiters outside of them
+		 * give the fields; inside carries this between calls (all ones if
+		 * the last character processed was inside quotes), start is the
+		 * start of the current field
+		 * returns false if the line ended inside a quoted field (i.e. the
+		 * field continues in the next line), in this case, the last field
+		 * is not stored */
+		bool split_quoted(size_t from, uint64_t& inside, size_t& start);
+		/* add the field between start and end to known_fields */
+		void add_quoted_field(size_t start, size_t end) {
+			if(end - start >= 2 && buf[start] == quote && buf[end-1] == quote)
+				known_fields.push_back(std::make_pair(start + 1,end - start - 2));
+			else known_fields.push_back(std::make_pair(start,end - start));
+		}
+		/* split a complete line (an unterminated quoted field lasts until
+		 * its end) */
+		void split_quoted_line() {
+			known_fields.clear();
+			uint64_t inside = 0;
+			size_t start = 0;
+			if(!split_quoted(0,inside,start)) add_quoted_field(start,buf.size());
+			have_known_fields = true;
+		}
+		/* bit mask of bytes equal to c in the 8-byte word w */
+		static uint64_t char_mask8(uint64_t w, char c) {
+			const uint64_t ones = 0x0101010101010101ULL;
+			const uint64_t high = 0x8080808080808080ULL;
+			w ^= ones * (unsigned char)c; /* zero bytes where there is a match */
+			w = ~(((w & ~high) + ~high) | w) & high; /* 0x80 in each zero byte */
+			return ((w >> 7) * 0x0102040810204080ULL) >> 56; /* collect the bits */
+		}
+		static uint64_t prefix_xor(uint64_t x) {
+			x ^= x << 1;
+			x ^= x << 2;
+			x ^= x << 4;
+			x ^= x << 8;
+			x ^= x << 16;
+			x ^= x << 32;
+			return x;
+		}
 		
 		void line_parser_init(line_parser_params par) {
+			have_known_fields = false;
 			pos = 0;
 			col = 0;
 			base = par.base;
 			delim = par.delim;
 			comment = par.comment;
 			allow_nan_inf = par.allow_nan_inf;
+			quote = par.delim ? par.quote : 0;
+			quoted = false;
 			last_error = T_OK;
+			if(quote && buf.size()) split_quoted_line();
 		}
 		
 	public:
@@ -258,9 +357,11 @@ struct line_parser {
 		template<class... Args>
 		void set_line(Args&&... args) {
 			buf = std::string(std::forward<Args>(args)...);
+			have_known_fields = false;
 			col = 0;
 			pos = 0;
 			last_error = T_OK;
+			if(quote) split_quoted_line();
 		}
 		/* get current line string */
 		const char* get_line_c_str() const { return buf.c_str(); }
@@ -293,8 +394,10 @@ struct line_parser {
 		void set_comment(char comment_) { comment = comment_; }
 		/* get comment character (default is none) */
 		char get_comment() const { return comment; }
+		/* get quote character (default is none) */
+		char get_quote() const { return quote; }
 		line_parser_params get_params() const {
-			return line_parser_params().set_base(base).set_delim(delim).set_allow_nan_inf(allow_nan_inf).set_comment(comment);
+			return line_parser_params().set_base(base).set_delim(delim).set_allow_nan_inf(allow_nan_inf).set_comment(comment).set_quote(quote);
 		}
 		void reset_pos() {
 			if(last_error != T_COPIED) {
@@ -336,6 +439,14 @@ struct line_parser {
 		/* read one double value in the given li/vector/mits */
 		bool read_double_limits(double& d, double min, double max, bool advance_pos = true);
 		bool read_double(double& d, bool advance_pos = true);
+		/* read one fixed point decimal number with the given number of digits
+		 * after the decimal point, stored as an integer (multiplied by 10^digits) */
+		bool read_fixed_point(int64_t& i, unsigned int digits, bool advance_pos = true);
+		/* read a timestamp, either in ISO-8601 format (YYYY-MM-DDTHH:MM:SS with
+		 * optional fractional seconds and time zone) or as a number of seconds
+		 * since the epoch; the result is the number of nanoseconds since
+		 * 1970-01-01T00:00:00Z */
+		bool read_timestamp(int64_t& ns, bool advance_pos = true);
 		/* read string, copying from the buffer */
 		bool read_string(std::string& str, bool advance_pos = true);
 		/* read string, return readonly view */
@@ -352,6 +463,8 @@ struct line_parser {
 		/* read string return start position and length
 		 *  -- the other read_string functions then use these to create the string_view or copy to a string */
 		bool read_string2(std::pair<size_t,size_t>& pos1, bool advance_pos = true);
+		/* parse the date and time part of an ISO-8601 timestamp */
+		static bool parse_iso_datetime(const char* c, size_t len, bool allow_space, int64_t& sec, size_t& used);
 };
 
 
@@ -361,12 +474,31 @@ struct read_table2 : public line_parser {
 		std::istream* is; /* input stream -- note: only a pointer is stored, the caller either supplies an input stream or a
 			file name; in the former case, the original object should not go out of scope while this struct is used */
 		std::ifstream* fs; /* file stream if it is opened by us */
+		/* decompression of the input if it is compressed: is then points to dzs,
+		 * which reads decompressed data from the original stream */
+		std::unique_ptr<decompress_buf> dz;
+		std::unique_ptr<std::istream> dzs;
+		/* input in the binary table format (see binary_table.h) */
+		std::unique_ptr<binary_table_reader> bin;
+		/* JSON Lines input: members extracted from the original line */
+		std::unique_ptr<json_lines> json;
+		/* fixed-width input: field widths and record length (if fixed) */
+		std::vector<size_t> widths;
+		size_t record_len;
+		/* original line if it is converted (JSON or fixed-width input) */
+		std::string input_line;
 		const char* fn; /* file name, stored optionally for error output */
 		uint64_t line; /* current line (count starts from 1) */
 		read_table2() = delete; /* user should supply either an input stream or a filename to use */
 		read_table2(const read_table2& r) = delete; /* disallow copying, only moving is possible */
 		/* helper function for the constructors to set default values */
 		void read_table_init(line_parser_params par);
+		/* check if the input is compressed or a binary table and set up
+		 * decompressing or decoding it */
+		void open_compressed();
+		/* copy the fixed-width fields of input_line to buf, separated by
+		 * delim and without the blanks they are padded with */
+		void split_fixed_width();
 	public:
 		
 		/* 1. constructors -- need to give a file name or an already open input stream */
@@ -392,9 +524,45 @@ struct read_table2 : public line_parser {
 		
 		/* get current position in the file */
 		uint64_t get_line() const { return line; }
+		
+		/* position in the input before the next line (can be used with seek()
+		 * later to continue from there); for compressed input, this is only
+		 * supported for the BGZF and zstd seekable formats (see
+		 * read_compressed.h), not for binary tables; returns -1 if not supported */
+		int64_t tell() { return bin ? -1 : (int64_t)is->tellg(); }
+		/* continue reading from a position returned by tell() earlier
+		 * (note: line numbers are not updated) */
+		bool seek(int64_t offset);
+		/* parse the field widths of fixed-width input given as a
+		 * comma-separated list, optionally followed by :LEN for records
+		 * of length LEN (not separated by newlines) */
+		static bool parse_widths(const char* s, std::vector<size_t>& widths, size_t& record_len) {
+			widths.clear();
+			record_len = 0;
+			const char* len = strchr(s,':');
+			std::string list = len ? std::string(s,len - s) : std::string(s);
+			line_parser lp(line_parser_params().set_delim(','),list);
+			uint32_t x;
+			while(lp.read(read_bounds(x,1U,UINT32_MAX))) widths.push_back(x);
+			if(lp.get_last_error() != T_EOL || widths.empty()) return false;
+			if(len) {
+				line_parser lp2(len + 1);
+				uint64_t total = 0;
+				for(size_t w : widths) total += w;
+				if(!(lp2.read(read_bounds(x,1U,UINT32_MAX)) && x >= total)) return false;
+				record_len = x;
+			}
+			return true;
+		}
 		/* set filename (for better formatting of diagnostic messages) */
 		void set_fn_for_diag(const char* fn_) { fn = fn; }
 		const char* get_fn() const { return fn; }
+		/* the input is a binary table (NULL if not) */
+		const binary_table_reader* get_binary() const { return bin.get(); }
+		/* the current line as it was read from the input (for JSON Lines
+		 * and fixed-width input, get_line_str() returns the extracted
+		 * values instead) */
+		const std::string& get_input_line() const { return (json || widths.size()) ? input_line : buf; }
 		
 		/* write formatted error message to the given stream */
 		void write_error(std::ostream& f) const;
@@ -405,11 +573,44 @@ struct read_table2 : public line_parser {
 
 /* constructor -- allocate new read_table2 struct, fill in the necessary fields */
 void read_table2::read_table_init(line_parser_params par) {
+	if(par.json_keys) {
+		/* lines are converted to tab-separated values */
+		json.reset(new json_lines(*par.json_keys));
+		par = line_parser_params().set_delim('\t').set_base(par.base).set_allow_nan_inf(par.allow_nan_inf);
+	}
+	record_len = 0;
+	if(par.widths) {
+		widths = *par.widths;
+		record_len = par.record_len;
+		par = line_parser_params().set_delim('\t').set_base(par.base).set_allow_nan_inf(par.allow_nan_inf);
+	}
 	line_parser_init(par);
 	line = 0;
 	fn = 0;
 }
 
+/* if the input starts with the magic bytes of a compressed format, read it
+ * through a decompress_buf instead; if the (decompressed) input is a binary
+ * table, lines are read from it with their fields already known, which
+ * can be used if they are separated by the same delimiter as given here */
+void read_table2::open_compressed() {
+	if(!is || last_error == T_ERROR_FOPEN) return;
+	if(decompress_buf::is_compressed(*is)) {
+		dz.reset(new decompress_buf(is->rdbuf()));
+		if(!dz->start()) { last_error = T_ERROR_DECOMPRESS; return; }
+		dzs.reset(new std::istream(dz.get()));
+		dzs->exceptions(std::ios_base::goodbit);
+		is = dzs.get();
+	}
+	/* note: this reads the first block of compressed input already */
+	bool binary = binary_table_reader::is_binary(*is);
+	if(dz && dz->failed()) { last_error = T_ERROR_DECOMPRESS; return; }
+	if(binary) {
+		bin.reset(new binary_table_reader(*is));
+		if(!bin->start()) { last_error = T_ERROR_BINARY; return; }
+	}
+}
+
 read_table2::read_table2(const char* fn_, line_parser_params par) {
 	fs = new std::ifstream(fn_);
 	if( !fs || !(fs->is_open()) || fs->fail() ) last_error = T_ERROR_FOPEN;
@@ -417,6 +618,7 @@ read_table2::read_table2(const char* fn_, line_parser_params par) {
 	is = fs;
 	read_table_init(par);
 	fn = fn_;
+	open_compressed();
 }
 
 read_table2::read_table2(const char* fn_, std::istream& is_, line_parser_params par) {
@@ -433,6 +635,7 @@ read_table2::read_table2(const char* fn_, std::istream& is_, line_parser_params
 	}
 	read_table_init(par);
 	fn = fn_;
+	open_compressed();
 }
 
 read_table2::read_table2(std::istream& is_, line_parser_params par) {
@@ -440,11 +643,14 @@ read_table2::read_table2(std::istream& is_, line_parser_params par) {
 	fs = 0;
 	is->exceptions(std::ios_base::goodbit); /* clear exception mask -- no exceptions thrown, error checking done separately */
 	read_table_init(par);
+	open_compressed();
 }
 
 /* destructor -- closes the input stream only if it was opened in the 
  * constructor (i.e. the constructor was called with a filename */
 read_table2::~read_table2() {
+	dzs.reset();
+	dz.reset(); /* stops decompression before closing the file */
 	if(fs) delete fs;
 }
 
@@ -463,6 +669,17 @@ read_table2::read_table2(read_table2&& r):line_parser(std::move(r.buf)) {
 	allow_nan_inf = r.allow_nan_inf;
 	fs = r.fs;
 	is = r.is;
+	dz = std::move(r.dz);
+	dzs = std::move(r.dzs);
+	quote = r.quote;
+	quoted = r.quoted;
+	bin = std::move(r.bin);
+	json = std::move(r.json);
+	widths = std::move(r.widths);
+	record_len = r.record_len;
+	input_line = std::move(r.input_line);
+	have_known_fields = r.have_known_fields;
+	known_fields = std::move(r.known_fields);
 	r.last_error = T_COPIED;
 	r.fs = 0;
 }
@@ -474,11 +691,44 @@ read_table2::read_table2(read_table2&& r):line_parser(std::move(r.buf)) {
  * nonempty line is found); otherwise, empty lines are read and stored as well,
  * which will probably result in errors if data is tried to be parsed from it */
 bool read_table2::read_line(bool skip) {
-	if(last_error == T_EOF || last_error == T_COPIED ||
-		last_error == T_ERROR_FOPEN) return false;
+	if(last_error == T_EOF || last_error == T_COPIED || last_error == T_ERROR_FOPEN ||
+		last_error == T_ERROR_DECOMPRESS || last_error == T_ERROR_BINARY) return false;
+	if(bin) {
+		/* binary table: lines are never empty or comments */
+		if(!bin->next(buf,known_fields)) {
+			if(dz && dz->failed()) last_error = T_ERROR_DECOMPRESS;
+			else last_error = bin->failed() ? T_ERROR_BINARY : T_EOF;
+			return false;
+		}
+		/* fields are known if they are separated by the same delimiter */
+		have_known_fields = (bin->get_delim() == delim);
+		line++;
+		pos = 0;
+		col = 0;
+		last_error = T_OK;
+		return true;
+	}
+	if(record_len) {
+		/* fixed length records: no need to search for line ends */
+		input_line.resize(record_len);
+		is->read(&input_line[0],record_len);
+		size_t n = is->gcount();
+		if(dz && dz->failed()) { last_error = T_ERROR_DECOMPRESS; return false; }
+		if(n < record_len) {
+			/* end of input, possibly with an incomplete record */
+			if(n) line++;
+			last_error = is->bad() ? T_READ_ERROR : (n ? T_FORMAT : T_EOF);
+			return false;
+		}
+		line++;
+		split_fixed_width();
+		return true;
+	}
+	if(dz && dz->failed()) { last_error = T_ERROR_DECOMPRESS; return false; }
 	if(is->eof()) { last_error = T_EOF; return false; }
 	while(1) {
 		std::getline(*is,buf);
+		if(dz && dz->failed()) { last_error = T_ERROR_DECOMPRESS; return false; }
 		if(is->eof()) { last_error = T_EOF; return false; }
 		if(is->fail()) { last_error = T_READ_ERROR; return false; }
 		size_t len = buf.size();
@@ -495,6 +745,122 @@ bool read_table2::read_line(bool skip) {
 		else break; /* if empty lines should not be skipped */
 	}
 	col = 0; /* reset the counter for columns */
+	if(json) {
+		/* keep the original and extract the requested members */
+		pos = 0;
+		input_line.swap(buf);
+		if(!json->extract(input_line.data(),input_line.size(),buf,delim)) {
+			last_error = T_FORMAT;
+			return false;
+		}
+	}
+	else if(widths.size()) {
+		input_line.swap(buf);
+		split_fixed_width();
+		return true;
+	}
+	if(quote) {
+		/* quoted fields can contain newlines, add more lines until all
+		 * quotes are closed */
+		known_fields.clear();
+		uint64_t inside = 0;
+		size_t start = 0;
+		size_t from = 0;
+		while(!split_quoted(from,inside,start)) {
+			std::string tmp;
+			std::getline(*is,tmp);
+			if(dz && dz->failed()) { last_error = T_ERROR_DECOMPRESS; return false; }
+			if(is->fail()) { last_error = is->eof() ? T_FORMAT : T_READ_ERROR; return false; } /* unterminated quote */
+			line++;
+			from = buf.size();
+			buf += '\n';
+			buf += tmp;
+		}
+		have_known_fields = true;
+	}
+	last_error = T_OK;
+	return true;
+}
+
+void read_table2::split_fixed_width() {
+	/* field positions are given by the widths, fields missing from the end
+	 * of a short line are empty */
+	const char* c = input_line.data();
+	size_t len = input_line.size();
+	buf.clear();
+	known_fields.clear();
+	size_t end = 0;
+	for(size_t i=0;i<widths.size();i++) {
+		size_t start = end < len ? end : len;
+		end += widths[i];
+		size_t e = end < len ? end : len;
+		while(start < e && c[start] == ' ') start++;
+		while(e > start && c[e-1] == ' ') e--;
+		if(i) buf += delim;
+		known_fields.push_back(std::make_pair(buf.size(),e - start));
+		/* tabs and newlines in a field would split the converted line */
+		size_t j = buf.size();
+		buf.append(c + start,e - start);
+		for(;j<buf.size();j++) if(buf[j] == '\t' || buf[j] == '\n' || buf[j] == '\r') buf[j] = ' ';
+	}
+	have_known_fields = true;
+	pos = 0;
+	col = 0;
+	last_error = T_OK;
+}
+
+bool line_parser::split_quoted(size_t from, uint64_t& inside, size_t& start) {
+	size_t len = buf.size();
+	const char* c = buf.data();
+	/* blocks are aligned to from, the last word is padded with zeros
+	 * (which cannot match the delimiter or the quote) */
+	for(size_t b = from; b < len; b += 64) {
+		size_t n = len - b;
+		if(n > 64) n = 64;
+		uint64_t q = 0;
+		uint64_t d = 0;
+		size_t i = 0;
+		for(; i + 8 <= n; i += 8) {
+			uint64_t w;
+			memcpy(&w,c + b + i,8);
+			q |= char_mask8(w,quote) << i;
+			d |= char_mask8(w,delim) << i;
+		}
+		if(i < n) {
+			uint64_t w = 0;
+			memcpy(&w,c + b + i,n - i);
+			q |= char_mask8(w,quote) << i;
+			d |= char_mask8(w,delim) << i;
+		}
+		uint64_t in = prefix_xor(q) ^ inside;
+		inside = (in >> (n - 1)) & 1 ? ~0ULL : 0; /* state after the last character */
+		d &= ~in;
+		/* make space for the fields found here and the last one at once */
+		size_t need = known_fields.size() + __builtin_popcountll(d) + 1;
+		if(need > known_fields.capacity()) known_fields.reserve(std::max(need,2*known_fields.capacity()));
+		while(d) {
+			size_t end = b + __builtin_ctzll(d);
+			add_quoted_field(start,end);
+			start = end + 1;
+			d &= d - 1;
+		}
+	}
+	if(inside) return false;
+	add_quoted_field(start,len);
+	return true;
+}
+
+/* go to a position returned by tell() */
+bool read_table2::seek(int64_t offset) {
+	if(last_error == T_COPIED || last_error == T_ERROR_FOPEN || bin) return false;
+	is->clear();
+	if(!is->seekg(offset)) {
+		last_error = (dz && dz->failed()) ? T_ERROR_DECOMPRESS : T_READ_ERROR;
+		return false;
+	}
+	buf.clear();
+	pos = 0;
+	col = 0;
 	last_error = T_OK;
 	return true;
 }
@@ -502,7 +868,8 @@ bool read_table2::read_line(bool skip) {
 /* checks to be performed before trying to convert a field */
 bool line_parser::read_table_pre_check(bool advance_pos) {
 	if(last_error == T_EOF || last_error == T_EOL ||
-		last_error == T_READ_ERROR || last_error == T_ERROR_FOPEN) return false;
+		last_error == T_READ_ERROR || last_error == T_ERROR_FOPEN ||
+		last_error == T_ERROR_DECOMPRESS || last_error == T_ERROR_BINARY) return false;
 	/* 1. skip any blanks */
 	size_t old_pos = pos;
 	size_t len = buf.size();
@@ -520,6 +887,18 @@ bool line_parser::read_table_pre_check(bool advance_pos) {
 		if(!advance_pos) pos = old_pos;
 		return false;
 	}
+	/* 4. skip the opening quote (the closing one is checked in
+	 * read_table_post_check()) */
+	quoted = false;
+	if(quote && buf[pos] == quote) {
+		if(pos + 1 < len && buf[pos+1] == quote) {
+			last_error = T_MISSING; /* empty quoted field */
+			if(!advance_pos) pos = old_pos;
+			return false;
+		}
+		pos++;
+		quoted = true;
+	}
 	return true;
 }
 
@@ -534,11 +913,19 @@ bool line_parser::read_table_post_check(const char* c2) {
 		last_error = T_OVERFLOW;
 		return false;
 	}
-	/* 1. skip the converted number and any blanks */
+	/* 1. skip the converted number, closing quote and any blanks */
+	if(quoted) {
+		if(*c2 != quote) {
+			last_error = T_FORMAT;
+			return false;
+		}
+		c2++;
+		quoted = false;
+	}
 	bool have_blank = false;
 	size_t len = buf.size();
 	for(pos = c2 - buf.c_str();pos<len;pos++)
-		if( ! (buf[pos] == ' ' || buf[pos] == '\t') ) break;
+		if( ! (buf[pos] == ' ' || buf[pos] == '\t') || buf[pos] == delim ) break;
 		else have_blank = true;
 	last_error = T_OK;
 	/* 2. check for end of line -- this is not a problem here */
@@ -569,6 +956,10 @@ bool line_parser::read_table_post_check(const char* c2) {
  * if no delimiter, this means skipping any blanks, than any nonblanks and
  * 	ending at the next blank */
 bool line_parser::read_skip() {
+	if(have_known_fields) {
+		std::pair<size_t,size_t> f;
+		return next_known_field(f);
+	}
 	size_t len = buf.size();
 	if(delim) {
 		/* if there is a delimiter, just advance until after the next one */
@@ -603,6 +994,12 @@ bool line_parser::read_skip() {
 bool line_parser::read_string2(std::pair<size_t,size_t>& pos1, bool advance_pos) {
 	size_t len = buf.size();
 	size_t old_pos = pos;
+	if(have_known_fields) {
+		size_t old_col = col;
+		if(!next_known_field(pos1)) return false;
+		if(!advance_pos) { pos = old_pos; col = old_col; }
+		return true;
+	}
 	if(delim) {
 		if(last_error == T_EOF || last_error == T_EOL ||
 			last_error == T_READ_ERROR || last_error == T_ERROR_FOPEN) return false;
@@ -873,6 +1270,219 @@ bool line_parser::read_double_limits(double& d, double min, double max, bool adv
 	return ret;
 }
 
+/* try to convert the next value to a fixed point decimal number, i.e. an
+ * integer that is the value multiplied by 10^digits (so 12.34 is stored as
+ * 1234 if digits == 2); there can be at most the given number of digits after
+ * the decimal point (except for trailing zeros), as more digits cannot be
+ * represented exactly
+ * return true on success, false on error */
+bool line_parser::read_fixed_point(int64_t& i, unsigned int digits, bool advance_pos) {
+	size_t old_pos = pos;
+	if(!read_table_pre_check(advance_pos)) return false;
+	const char* c = buf.c_str() + pos;
+	bool neg = false;
+	if(*c == '-' || *c == '+') { neg = (*c == '-'); c++; }
+	/* note: the absolute value of INT64_MIN is INT64_MAX + 1 */
+	const uint64_t max = neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+	uint64_t res = 0;
+	bool have_digit = false;
+	bool ret = true;
+	unsigned int frac = 0; /* number of digits after the decimal point */
+	for(; isdigit(*c); c++) {
+		unsigned int d = *c - '0';
+		have_digit = true;
+		if(res > (max - d) / 10) ret = false;
+		else res = res*10 + d;
+	}
+	if(*c == '.') for(c++; isdigit(*c); c++) {
+		unsigned int d = *c - '0';
+		have_digit = true;
+		if(frac == digits) {
+			/* only trailing zeros are allowed */
+			if(d) { last_error = T_FORMAT; if(!advance_pos) pos = old_pos; return false; }
+			continue;
+		}
+		if(res > (max - d) / 10) ret = false;
+		else res = res*10 + d;
+		frac++;
+	}
+	for(; frac < digits; frac++) {
+		if(res > max / 10) ret = false;
+		else res *= 10;
+	}
+	if(!have_digit) c = buf.c_str() + pos; /* signal format error */
+	if(!ret && have_digit) {
+		last_error = T_OVERFLOW;
+		i = neg ? INT64_MIN : INT64_MAX;
+	}
+	else {
+		i = neg ? (int64_t)(0 - res) : (int64_t)res;
+		/* advance position after the number, check if there is proper field separator */
+		errno = 0;
+		ret = read_table_post_check(c);
+	}
+	if(!advance_pos) pos = old_pos;
+	return ret;
+}
+
+/* number of days since 1970-01-01 for the given date in the proleptic
+ * Gregorian calendar (algorithm from H. Hinnant:
+ * http://howardhinnant.github.io/date_algorithms.html) */
+static inline int64_t read_table_days_from_civil(int64_t y, unsigned int m, unsigned int d) {
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned int yoe = (unsigned int)(y - era * 400);
+	const unsigned int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+/* parse the fixed layout part of an ISO-8601 timestamp, either a date
+ * (YYYY-MM-DD) or date and time (YYYY-MM-DDTHH:MM:SS, the T can also be a
+ * space if allow_space is true); the result is the number of seconds since the epoch, the number
+ * of characters used is stored in used
+ * 
+ * characters are checked and converted 8 at a time, using 64-bit integer
+ * operations (SWAR); values are then checked to be valid */
+bool line_parser::parse_iso_datetime(const char* c, size_t len, bool allow_space, int64_t& sec, size_t& used) {
+	const uint64_t ones = 0x0101010101010101ULL;
+	if(len < 10) return false;
+	/* 1. YYYY-MM- (bytes 0-7, note: little endian byte order is assumed
+	 * for the masks, the bytes are loaded in this order explicitly) */
+	uint64_t lo = 0;
+	for(int i=7;i>=0;i--) lo = (lo << 8) | (unsigned char)c[i];
+	const uint64_t lo_digits = 0x00FFFF00FFFFFFFFULL;
+	const uint64_t lo_sep = 0x2D00002D00000000ULL; /* '-' at bytes 4 and 7 */
+	if((lo & ~lo_digits) != lo_sep) return false;
+	/* check that the remaining bytes are digits: the high nibble has to be
+	 * 3 and adding 6 should not change it (i.e. the low nibble is < 10) */
+	if(((lo & lo_digits & (0xF0 * ones)) != (lo_digits & (0x30 * ones))) ||
+		(((lo + 0x06 * ones) & lo_digits & (0xF0 * ones)) != (lo_digits & (0x30 * ones)))) return false;
+	/* convert digits to values, combine pairs of digits */
+	uint64_t d = (lo & lo_digits) - (lo_digits & (0x30 * ones));
+	uint64_t t = d * 10 + (d >> 8);
+	int64_t year = (int64_t)(t & 0xFF) * 100 + (int64_t)((t >> 16) & 0xFF);
+	unsigned int month = (t >> 40) & 0xFF;
+	/* 2. DD or DDTHH:MM:SS */
+	if(!(isdigit(c[8]) && isdigit(c[9]))) return false;
+	unsigned int day = (c[8] - '0') * 10 + (c[9] - '0');
+	unsigned int hour = 0, minute = 0, second = 0;
+	used = 10;
+	if(len >= 19 && (c[10] == 'T' || (allow_space && c[10] == ' ')) && isdigit(c[11])) {
+		/* bytes 8-15: DDTHH:MM */
+		uint64_t hi = 0;
+		for(int i=15;i>=8;i--) hi = (hi << 8) | (unsigned char)c[i];
+		const uint64_t hi_digits = 0xFFFF00FFFF00FFFFULL;
+		uint64_t sep = hi & ~hi_digits;
+		if(sep != 0x00003A0000540000ULL && sep != 0x00003A0000200000ULL) return false;
+		if(((hi & hi_digits & (0xF0 * ones)) != (hi_digits & (0x30 * ones))) ||
+			(((hi + 0x06 * ones) & hi_digits & (0xF0 * ones)) != (hi_digits & (0x30 * ones)))) return false;
+		d = (hi & hi_digits) - (hi_digits & (0x30 * ones));
+		t = d * 10 + (d >> 8);
+		hour = (t >> 24) & 0xFF;
+		minute = (t >> 48) & 0xFF;
+		/* bytes 16-18: :SS */
+		if(!(c[16] == ':' && isdigit(c[17]) && isdigit(c[18]))) return false;
+		second = (c[17] - '0') * 10 + (c[18] - '0');
+		used = 19;
+	}
+	/* 3. check values */
+	static const unsigned int mdays[] = {31,28,31,30,31,30,31,31,30,31,30,31};
+	if(month < 1 || month > 12 || day < 1) return false;
+	bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	if(day > mdays[month-1] + (month == 2 && leap ? 1 : 0)) return false;
+	if(hour > 23 || minute > 59 || second > 59) return false;
+	sec = read_table_days_from_civil(year,month,day) * 86400 + hour * 3600 + minute * 60 + second;
+	return true;
+}
+
+/* try to convert the next value to a timestamp (see above)
+ * ISO-8601 timestamps can have up to 9 digits of fractional seconds and
+ * a time zone given as Z, +HH:MM, +HHMM or +HH (or the same with -); if there
+ * is no time zone, UTC is assumed; the date can be given alone as well
+ * other values are interpreted as the number of seconds since the epoch,
+ * with up to 9 digits after the decimal point
+ * return true on success, false on error */
+bool line_parser::read_timestamp(int64_t& ns, bool advance_pos) {
+	size_t old_pos = pos;
+	if(!read_table_pre_check(advance_pos)) return false;
+	size_t len = buf.size() - pos;
+	const char* c0 = buf.c_str() + pos;
+	if(!(len >= 10 && c0[4] == '-' && isdigit(c0[0]))) {
+		/* not ISO-8601 format, try to read as a number (this checks the
+		 * field again, including any opening quote) */
+		pos = old_pos;
+		quoted = false;
+		return read_fixed_point(ns,9,advance_pos);
+	}
+	int64_t sec;
+	size_t used;
+	/* note: a space between the date and time is only accepted if it
+	 * cannot be a field separator */
+	if(!parse_iso_datetime(c0,len,delim && delim != ' ',sec,used)) {
+		last_error = T_FORMAT;
+		if(!advance_pos) pos = old_pos;
+		return false;
+	}
+	const char* c = c0 + used;
+	int64_t frac = 0;
+	if(used == 19) {
+		if(*c == '.' || *c == ',') {
+			c++;
+			unsigned int n = 0;
+			for(; isdigit(*c) && n < 9; c++, n++) frac = frac * 10 + (*c - '0');
+			if(n == 0 || isdigit(*c)) {
+				/* no digits or too many digits */
+				last_error = T_FORMAT;
+				if(!advance_pos) pos = old_pos;
+				return false;
+			}
+			for(; n < 9; n++) frac *= 10;
+		}
+		if(*c == 'Z') c++;
+		else if(*c == '+' || *c == '-') {
+			int sign = (*c == '-') ? -1 : 1;
+			c++;
+			int off = 0;
+			bool valid = isdigit(c[0]) && isdigit(c[1]);
+			if(valid) {
+				unsigned int oh = (c[0] - '0') * 10 + (c[1] - '0');
+				unsigned int om = 0;
+				c += 2;
+				if(*c == ':') {
+					c++;
+					valid = isdigit(c[0]) && isdigit(c[1]);
+					if(valid) { om = (c[0] - '0') * 10 + (c[1] - '0'); c += 2; }
+				}
+				else if(isdigit(c[0])) {
+					valid = isdigit(c[1]);
+					if(valid) { om = (c[0] - '0') * 10 + (c[1] - '0'); c += 2; }
+				}
+				if(oh > 23 || om > 59) valid = false;
+				off = sign * (int)(oh * 3600 + om * 60);
+			}
+			if(!valid) {
+				last_error = T_FORMAT;
+				if(!advance_pos) pos = old_pos;
+				return false;
+			}
+			sec -= off;
+		}
+	}
+	/* convert to nanoseconds, check for overflow */
+	const int64_t max_sec = INT64_MAX / 1000000000LL;
+	if(sec > max_sec || sec < -max_sec || (sec == max_sec && frac > INT64_MAX % 1000000000LL)) {
+		last_error = T_OVERFLOW;
+		ns = sec > 0 ? INT64_MAX : INT64_MIN;
+		if(!advance_pos) pos = old_pos;
+		return false;
+	}
+	ns = sec * 1000000000LL + frac;
+	errno = 0;
+	bool ret = read_table_post_check(c);
+	if(!advance_pos) pos = old_pos;
+	return ret;
+}
 
 
 /* write formatted error message to the given stream */
@@ -880,7 +1490,10 @@ void read_table2::write_error(std::ostream& f) const {
 	f<<"read_table, ";
 	if(fn) f<<"file "<<fn<<", ";
 	else f<<"input ";
-	f<<"line "<<line<<", position "<<pos<<" / column "<<col<<": "<<get_error_desc(last_error)<<"\n";
+	f<<"line "<<line<<", position "<<pos<<" / column "<<col<<": "<<get_error_desc(last_error);
+	if(last_error == T_ERROR_DECOMPRESS && dz) f<<": "<<dz->get_error();
+	if(last_error == T_ERROR_BINARY && bin) f<<": "<<bin->get_error();
+	f<<"\n";
 }
 
 
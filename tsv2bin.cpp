@@ -0,0 +1,214 @@
+/*
+ * tsv2bin.cpp -- convert a text file (e.g. TSV) to the binary table format
+ *   read directly by numjoin and hashjoin (see binary_table.h)
+ *
+ * lines are stored in groups with the position of each field, so they do
+ * not have to be searched for delimiters again when reading; columns that
+ * contain only integers can be stored as such (-i)
+ *
+ * Copyright 2018 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <iostream>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include "read_table_cpp.h"
+#include "write_buffer.h"
+
+
+const char usage[] = R"!!!(Usage: tsv2bin [OPTION]... [INPUT [OUTPUT]]
+Convert a text file with delimited fields to a binary format that can be read
+by numjoin and hashjoin directly (detected automatically), without searching
+for line ends and field delimiters again. This is useful if the same large
+file is joined many times.
+
+INPUT is read from standard input if not given or -, OUTPUT is written to
+standard output if not given. Compressed input is decompressed automatically
+as by numjoin; the output can be compressed with -Z (it is still detected
+and read directly).
+
+Lines are stored in groups of ROWS lines along with the position of each
+field. With -i, columns that contain only integers (in a group) are stored as
+numbers; this makes the file smaller, but reading it somewhat slower, since
+these fields have to be formatted as text again.
+Comments and empty lines are not kept; when joining, the same -t CHAR has to
+be given as here (lines read from the binary file have fields separated by
+CHAR, or tabs if -t is not given).
+
+  -t CHAR           use CHAR as field separator (default: blanks)
+  -C CHAR           use CHAR as comment indicator: lines beginning with
+                      CHAR are ignored
+  -H                the first line is a header (it is not checked with -k)
+  -k FIELD          the input is sorted on FIELD as integers (as required by
+                      numjoin with integer keys); this is checked and
+                      stored in the output, so that numjoin -S does not
+                      need to sort it again when joining on FIELD
+  -g ROWS           number of lines in a group (default: 65536)
+  -i                store integer columns as numbers
+  -Z METHOD[:LEVEL] compress the output with METHOD (gzip or zstd, as for
+                      numjoin)
+  -h                display this help and exit
+)!!!";
+
+
+int main(int argc, char** args) {
+	char delim = 0;
+	char comment = 0;
+	bool header = false;
+	unsigned int sort_field = 0;
+	size_t group_rows = 65536;
+	bool typed = false;
+	write_buffer::compression compress = write_buffer::COMPRESS_NONE;
+	int compress_level = -1;
+
+	int i = 1;
+	for(;i<argc;i++) if(args[i][0] == '-' && args[i][1] != 0) switch(args[i][1]) {
+		case 't':
+			delim = args[i+1][0];
+			i++;
+			break;
+		case 'C':
+			comment = args[i+1][0];
+			i++;
+			break;
+		case 'H':
+			header = true;
+			break;
+		case 'i':
+			typed = true;
+			break;
+		case 'k':
+		case 'g':
+			{
+				line_parser lp(args[i+1]);
+				uint32_t x;
+				if(!(lp.read(x) && x > 0)) { std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use tsv2bin -h for help\n"; return 1; }
+				if(args[i][1] == 'k') sort_field = x;
+				else group_rows = x;
+			}
+			i++;
+			break;
+		case 'Z':
+			if(!write_buffer::parse_compression(args[i+1],compress,compress_level)) {
+				std::cerr<<"Invalid parameter: "<<args[i]<<" "<<args[i+1]<<"\n  use tsv2bin -h for help\n";
+				return 1;
+			}
+			if(!write_buffer::compression_supported(compress)) {
+				std::cerr<<"Error: "<<args[i+1]<<" compression is not supported in this build\n";
+				return 1;
+			}
+			i++;
+			break;
+		case 'h':
+			std::cout<<usage;
+			return 0;
+		default:
+			std::cerr<<"Unknown parameter: "<<args[i]<<"\n  use tsv2bin -h for help\n";
+			return 1;
+	}
+	else break;
+	if(argc - i > 2) { std::cerr<<"Error: too many arguments\n  use tsv2bin -h for help\n"; return 1; }
+	const char* in_fn = (i < argc && strcmp(args[i],"-")) ? args[i] : 0;
+	const char* out_fn = (i + 1 < argc) ? args[i+1] : 0;
+
+	read_table2 rt(in_fn,std::cin,line_parser_params().set_delim(delim).set_comment(comment));
+	write_buffer sw(1);
+	if(out_fn && !sw.open_file(out_fn)) {
+		std::cerr<<"Error opening output file "<<out_fn<<": "<<sw.get_error_str()<<"\n";
+		return 1;
+	}
+	if(compress != write_buffer::COMPRESS_NONE && !sw.start_compress(compress,compress_level,std::thread::hardware_concurrency())) {
+		std::cerr<<"Error setting up output compression\n";
+		return 1;
+	}
+
+	binary_table_writer<write_buffer> bw(sw,delim,header,sort_field,group_rows,typed);
+	bw.start();
+	line_parser conv; /* used to parse the sort field */
+	int64_t prev_key = 0;
+	bool have_key = false;
+	bool first = true;
+	bool error = false;
+	while(rt.read_line()) {
+		size_t nfields = 0;
+		bool key_ok = false;
+		int64_t key = 0;
+		while(true) {
+			std::pair<size_t,size_t> f;
+			if(!rt.read_string_view_pair(f)) break;
+			const char* s = rt.get_line_c_str() + f.first;
+			bw.append(s,f.second);
+			nfields++;
+			if(nfields == sort_field) {
+				conv.set_line(s,f.second);
+				key_ok = conv.read_int64(key);
+			}
+		}
+		if(rt.get_last_error() != T_EOL) {
+			std::cerr<<"Error reading input:\n";
+			rt.write_error(std::cerr);
+			error = true;
+			break;
+		}
+		if(!sort_field || (header && first)) bw.end_row();
+		else {
+			if(!key_ok) {
+				std::cerr<<"Invalid value in the sorted field on line "<<rt.get_line()<<"\n";
+				error = true;
+				break;
+			}
+			if(have_key && key < prev_key) {
+				std::cerr<<"Input is not sorted on field "<<sort_field<<" (line "<<rt.get_line()<<")\n";
+				error = true;
+				break;
+			}
+			bw.end_row(key);
+			prev_key = key;
+			have_key = true;
+		}
+		first = false;
+	}
+	if(!error && rt.get_last_error() != T_EOF) {
+		std::cerr<<"Error reading input:\n";
+		rt.write_error(std::cerr);
+		error = true;
+	}
+	if(!error) bw.finish();
+	if(!sw.finish()) {
+		std::cerr<<"Error writing output: "<<sw.get_error_str()<<"\n";
+		error = true;
+	}
+	std::cerr<<"Lines written: "<<bw.get_rows()<<" in "<<bw.get_groups()<<" groups ("
+		<<bw.get_int_columns()<<" integer columns)\n";
+	return error ? 1 : 0;
+}
+
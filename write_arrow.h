@@ -0,0 +1,430 @@
+/*  -*- C++ -*-
+ * write_arrow.h -- output in the Apache Arrow IPC streaming format
+ *
+ * arrow_writer collects output lines as columns (record batches) and writes
+ * them as an Arrow IPC stream (https://arrow.apache.org/docs/format/Columnar.html)
+ * to a write_buffer, without depending on the Arrow library: the metadata
+ * (flatbuffers) is written by the minimal builder below, the column buffers
+ * are written directly from memory
+ *
+ * fields are given as text (e.g. views of fields in input lines); columns
+ * are either strings (Utf8) or typed, in which case the text is converted
+ * (64-bit signed and unsigned integers, doubles, decimals stored as 64-bit
+ * integers with a given number of digits after the decimal point, written
+ * as Decimal128, and timestamps with nanosecond precision, UTC); values
+ * that cannot be converted are written as nulls
+ *
+ * only little endian platforms are supported (the byte order of the output
+ * is always little endian, as required by most readers)
+ *
+ * Copyright 2018 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * example usage in C++
+
+write_buffer out(1);
+arrow_writer aw(out);
+aw.add_column("id",arrow_writer::ARROW_INT64);
+aw.add_column("name",arrow_writer::ARROW_UTF8);
+aw.start(); // writes the schema
+for(...) {
+	aw.append(0,id_str,id_len);
+	aw.append_null(1);
+	aw.end_row();
+}
+aw.finish(); // writes the last record batch and the end of the stream
+if(!out.finish()) { ... } // handle error
+
+ */
+
+#ifndef _WRITE_ARROW_H
+#define _WRITE_ARROW_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "read_table_cpp.h"
+#include "write_buffer.h"
+
+/*
+ * minimal flatbuffers builder: objects are written front to back, each
+ * table followed by its children, so offsets to children always point
+ * forward (as required); the vtable of each table is written right before it
+ */
+struct fb_builder {
+	std::string buf;
+	fb_builder():buf(4,0) { } /* offset of the root table, set by set_root() */
+
+	void align(size_t a) { buf.append((a - buf.size() % a) % a,0); }
+	/* field of a table: size (1, 2, 4 or 8 bytes, 0 if not present) and value;
+	 * offsets to other objects are written as 0 and set by set_offset() */
+	struct field {
+		unsigned int size;
+		uint64_t value;
+	};
+	/* write a table with the given fields; pos is set to the position of
+	 * each field; returns the position of the table */
+	size_t table(const std::vector<field>& fields, std::vector<size_t>& pos) {
+		size_t nf = fields.size();
+		align(2);
+		size_t vt = buf.size();
+		buf.append(4 + 2*nf,0);
+		align(4);
+		size_t t = buf.size();
+		int32_t soffset = (int32_t)(t - vt);
+		buf.append((const char*)&soffset,4);
+		pos.assign(nf,0);
+		for(size_t i=0;i<nf;i++) if(fields[i].size) {
+			align(fields[i].size);
+			pos[i] = buf.size();
+			buf.append((const char*)&fields[i].value,fields[i].size); /* little endian */
+		}
+		uint16_t tmp[2] = {(uint16_t)(4 + 2*nf), (uint16_t)(buf.size() - t)};
+		memcpy(&buf[vt],tmp,4);
+		for(size_t i=0;i<nf;i++) {
+			uint16_t x = pos[i] ? (uint16_t)(pos[i] - t) : 0;
+			memcpy(&buf[vt + 4 + 2*i],&x,2);
+		}
+		return t;
+	}
+	/* set the offset stored at position at to point to target */
+	void set_offset(size_t at, size_t target) {
+		uint32_t x = (uint32_t)(target - at);
+		memcpy(&buf[at],&x,4);
+	}
+	void set_root(size_t target) { set_offset(0,target); }
+	/* write a string, returns its position */
+	size_t string(const std::string& s) {
+		align(4);
+		size_t p = buf.size();
+		uint32_t len = (uint32_t)s.size();
+		buf.append((const char*)&len,4);
+		buf.append(s);
+		buf.push_back(0);
+		return p;
+	}
+	/* write a vector of n offsets (set later, the offset of element i is
+	 * at the returned position + 4 + 4*i) */
+	size_t offsets(size_t n) {
+		align(4);
+		size_t p = buf.size();
+		uint32_t len = (uint32_t)n;
+		buf.append((const char*)&len,4);
+		buf.append(4*n,0);
+		return p;
+	}
+	/* write a vector of n structs of 8-byte aligned data (size bytes each) */
+	size_t structs(const void* data, size_t n, size_t size) {
+		align(4);
+		if(buf.size() % 8 == 0) buf.append(4,0);
+		size_t p = buf.size();
+		uint32_t len = (uint32_t)n;
+		buf.append((const char*)&len,4);
+		buf.append((const char*)data,n*size);
+		return p;
+	}
+};
+
+class arrow_writer {
+	public:
+		enum col_type { ARROW_UTF8, ARROW_INT64, ARROW_UINT64, ARROW_DOUBLE, ARROW_DECIMAL, ARROW_TIMESTAMP };
+
+	protected:
+		struct column {
+			std::string name;
+			col_type type;
+			unsigned int scale; /* digits after the decimal point (ARROW_DECIMAL) */
+			std::string validity; /* bitmap of non-null values */
+			std::string values; /* fixed size values or string data */
+			std::vector<int32_t> offsets; /* start of strings in values (ARROW_UTF8) */
+			uint64_t nulls;
+			column(const std::string& name_, col_type type_, unsigned int scale_):
+				name(name_),type(type_),scale(scale_),nulls(0) { }
+		};
+
+		/* values of the Arrow flatbuffers schema used */
+		enum {
+			ARROW_VERSION_V5 = 4,
+			HEADER_SCHEMA = 1,
+			HEADER_RECORD_BATCH = 3,
+			TYPE_INT = 2,
+			TYPE_FLOATING_POINT = 3,
+			TYPE_UTF8 = 5,
+			TYPE_DECIMAL = 7,
+			TYPE_TIMESTAMP = 10,
+			PRECISION_DOUBLE = 2,
+			TIME_UNIT_NANOSECOND = 3
+		};
+
+		write_buffer& sw;
+		std::vector<column> cols;
+		size_t batch_rows; /* write a record batch after this many rows */
+		size_t rows; /* rows in the current batch */
+		size_t data_size; /* bytes of data in the current batch */
+		uint64_t total_rows;
+		uint64_t batches;
+		uint64_t invalid; /* values that could not be converted */
+		line_parser conv; /* used for converting values */
+
+		/* add a value (or null if data is NULL) of the given size */
+		void add_value(column& c, const void* data, size_t size) {
+			if(rows % 8 == 0) c.validity.push_back(0);
+			if(data) {
+				c.validity.back() |= (char)(1U << (rows % 8));
+				c.values.append((const char*)data,size);
+			}
+			else {
+				c.values.append(size,0);
+				c.nulls++;
+			}
+		}
+
+		/* write an encapsulated message: metadata (padded to 8 bytes) and body */
+		void write_message(fb_builder& fb) {
+			fb.align(8);
+			uint32_t header[2] = {0xFFFFFFFFU, (uint32_t)fb.buf.size()};
+			sw.write((const char*)header,8);
+			sw.write(fb.buf);
+		}
+		/* write the metadata of a message with the given header type, returns
+		 * the position of the offset to the header to be set */
+		static size_t message(fb_builder& fb, unsigned int header_type, uint64_t body_length) {
+			std::vector<size_t> pos;
+			size_t t = fb.table({{2,ARROW_VERSION_V5},{1,header_type},{4,0},{8,body_length}},pos);
+			fb.set_root(t);
+			return pos[2];
+		}
+
+		/* write one field (column) of the schema */
+		static size_t schema_field(fb_builder& fb, const column& c) {
+			unsigned int type = TYPE_UTF8;
+			switch(c.type) {
+				case ARROW_INT64:
+				case ARROW_UINT64:
+					type = TYPE_INT;
+					break;
+				case ARROW_DOUBLE:
+					type = TYPE_FLOATING_POINT;
+					break;
+				case ARROW_DECIMAL:
+					type = TYPE_DECIMAL;
+					break;
+				case ARROW_TIMESTAMP:
+					type = TYPE_TIMESTAMP;
+					break;
+				case ARROW_UTF8:
+					break;
+			}
+			std::vector<size_t> pos;
+			/* name, nullable, type_type, type, dictionary, children */
+			size_t t = fb.table({{4,0},{1,1},{1,type},{4,0},{0,0},{4,0}},pos);
+			fb.set_offset(pos[0],fb.string(c.name));
+			std::vector<size_t> pos2;
+			size_t tt = 0;
+			switch(c.type) {
+				case ARROW_INT64:
+				case ARROW_UINT64:
+					tt = fb.table({{4,64},{1,c.type == ARROW_INT64}},pos2);
+					break;
+				case ARROW_DOUBLE:
+					tt = fb.table({{2,PRECISION_DOUBLE}},pos2);
+					break;
+				case ARROW_DECIMAL:
+					/* precision: enough for any 64-bit integer */
+					tt = fb.table({{4,19},{4,c.scale},{4,128}},pos2);
+					break;
+				case ARROW_TIMESTAMP:
+					tt = fb.table({{2,TIME_UNIT_NANOSECOND},{4,0}},pos2);
+					fb.set_offset(pos2[1],fb.string("UTC"));
+					break;
+				case ARROW_UTF8:
+					tt = fb.table({},pos2);
+					break;
+			}
+			fb.set_offset(pos[3],tt);
+			fb.set_offset(pos[5],fb.offsets(0));
+			return t;
+		}
+
+		/* write the collected rows as a record batch */
+		void write_batch() {
+			struct fb_struct { int64_t a, b; };
+			std::vector<fb_struct> nodes;
+			std::vector<fb_struct> buffers;
+			int64_t body = 0;
+			auto add_buffer = [&](size_t len) {
+				buffers.push_back(fb_struct{body,(int64_t)len});
+				body += (len + 7) / 8 * 8;
+			};
+			for(const column& c : cols) {
+				nodes.push_back(fb_struct{(int64_t)rows,(int64_t)c.nulls});
+				add_buffer(c.nulls ? c.validity.size() : 0);
+				if(c.type == ARROW_UTF8) add_buffer(c.offsets.size()*sizeof(int32_t));
+				add_buffer(c.values.size());
+			}
+			fb_builder fb;
+			size_t h = message(fb,HEADER_RECORD_BATCH,body);
+			std::vector<size_t> pos;
+			/* length, nodes, buffers */
+			size_t t = fb.table({{8,rows},{4,0},{4,0}},pos);
+			fb.set_offset(h,t);
+			fb.set_offset(pos[1],fb.structs(nodes.data(),nodes.size(),sizeof(fb_struct)));
+			fb.set_offset(pos[2],fb.structs(buffers.data(),buffers.size(),sizeof(fb_struct)));
+			write_message(fb);
+
+			static const char zeros[8] = {0,0,0,0,0,0,0,0};
+			auto write_buffer_data = [&](const void* data, size_t len) {
+				sw.write((const char*)data,len);
+				if(len % 8) sw.write(zeros,8 - len % 8);
+			};
+			for(column& c : cols) {
+				if(c.nulls) write_buffer_data(c.validity.data(),c.validity.size());
+				if(c.type == ARROW_UTF8) write_buffer_data(c.offsets.data(),c.offsets.size()*sizeof(int32_t));
+				write_buffer_data(c.values.data(),c.values.size());
+				c.validity.clear();
+				c.values.clear();
+				c.offsets.assign(1,0);
+				c.nulls = 0;
+			}
+			total_rows += rows;
+			batches++;
+			rows = 0;
+			data_size = 0;
+		}
+
+	public:
+		/* write to sw; a record batch is written after every batch_rows
+		 * rows (or if the data in it exceeds 64 MB) */
+		explicit arrow_writer(write_buffer& sw_, size_t batch_rows_ = 65536):sw(sw_),
+			batch_rows(batch_rows_),rows(0),data_size(0),total_rows(0),batches(0),invalid(0) { }
+
+		/* add a column (has to be done before calling start()) */
+		void add_column(const std::string& name, col_type type, unsigned int scale = 0) {
+			cols.emplace_back(name,type,scale);
+			cols.back().offsets.push_back(0);
+		}
+		size_t columns() const { return cols.size(); }
+
+		/* write the schema, has to be called before adding data */
+		void start() {
+			fb_builder fb;
+			size_t h = message(fb,HEADER_SCHEMA,0);
+			std::vector<size_t> pos;
+			/* endianness (little), fields */
+			size_t t = fb.table({{2,0},{4,0}},pos);
+			fb.set_offset(h,t);
+			size_t v = fb.offsets(cols.size());
+			fb.set_offset(pos[1],v);
+			for(size_t i=0;i<cols.size();i++) fb.set_offset(v + 4 + 4*i,schema_field(fb,cols[i]));
+			write_message(fb);
+		}
+
+		/* add a value to column i in the current row, given as text */
+		void append(size_t i, const char* s, size_t len) {
+			column& c = cols[i];
+			data_size += len;
+			if(c.type == ARROW_UTF8) {
+				if(rows % 8 == 0) c.validity.push_back(0);
+				c.validity.back() |= (char)(1U << (rows % 8));
+				c.values.append(s,len);
+				c.offsets.push_back((int32_t)c.values.size());
+				return;
+			}
+			conv.set_line(s,len);
+			bool ok = false;
+			switch(c.type) {
+				case ARROW_INT64:
+				case ARROW_UINT64:
+				case ARROW_TIMESTAMP:
+					{
+						int64_t x = 0;
+						if(c.type == ARROW_INT64) ok = conv.read_int64(x);
+						else if(c.type == ARROW_TIMESTAMP) ok = conv.read_timestamp(x);
+						else {
+							uint64_t y = 0;
+							ok = conv.read_uint64(y);
+							x = (int64_t)y;
+						}
+						add_value(c,ok ? &x : 0,8);
+					}
+					break;
+				case ARROW_DOUBLE:
+					{
+						double x = 0.0;
+						ok = conv.read_double(x);
+						add_value(c,ok ? &x : 0,8);
+					}
+					break;
+				case ARROW_DECIMAL:
+					{
+						int64_t x[2] = {0, 0}; /* 128-bit little endian */
+						ok = conv.read_fixed_point(x[0],c.scale);
+						if(x[0] < 0) x[1] = -1;
+						add_value(c,ok ? x : 0,16);
+					}
+					break;
+				case ARROW_UTF8:
+					break;
+			}
+			if(!ok) invalid++;
+		}
+		/* add a null value to column i in the current row */
+		void append_null(size_t i) {
+			column& c = cols[i];
+			switch(c.type) {
+				case ARROW_UTF8:
+					if(rows % 8 == 0) c.validity.push_back(0);
+					c.offsets.push_back((int32_t)c.values.size());
+					c.nulls++;
+					break;
+				case ARROW_DECIMAL:
+					add_value(c,0,16);
+					break;
+				default:
+					add_value(c,0,8);
+					break;
+			}
+		}
+		/* finish the current row (a value has to be added to all columns) */
+		void end_row() {
+			rows++;
+			if(rows >= batch_rows || data_size >= 64*1048576UL) write_batch();
+		}
+		/* write the remaining rows and the end of the stream */
+		void finish() {
+			if(rows) write_batch();
+			uint32_t eos[2] = {0xFFFFFFFFU, 0};
+			sw.write((const char*)eos,8);
+		}
+
+		uint64_t get_rows() const { return total_rows + rows; }
+		uint64_t get_batches() const { return batches; }
+		/* number of values that could not be converted (written as nulls) */
+		uint64_t get_invalid() const { return invalid; }
+};
+
+#endif
+
@@ -0,0 +1,794 @@
+/*  -*- C++ -*-
+ * write_buffer.h -- buffered output of text directly to a file descriptor
+ *
+ * output is collected in a large buffer, whole fields are copied into it
+ * with memcpy() and it is written out with write(2) when full; this avoids
+ * the per-character overhead of iostreams; data larger than the buffer is
+ * written directly (together with the buffer contents, using writev(2))
+ * 
+ * optionally, output can be written by a separate thread (start_async()),
+ * so that writing does not block processing; full buffers are passed to
+ * the writer thread, while the next one is filled
+ * 
+ * output can also be compressed (start_compress()), with blocks of the
+ * buffer size compressed in parallel by multiple threads; gzip support
+ * requires zlib (link with -lz, or define NO_ZLIB to compile without it),
+ * zstd support requires libzstd and is enabled by defining HAVE_ZSTD
+ * (link with -lzstd); the result is always one valid gzip or zstd stream
+ *
+ * partitioned_output is a set of write_buffers writing to separate files,
+ * lines are distributed among them by a hash of their key
+ *
+ * Copyright 2018 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * output_plan is a precompiled description of the fields to write from
+ * a line (e.g. one input file of a join)
+ *
+ * example usage in C++
+
+write_buffer out(1); // write to stdout
+out.write(line.data(),line.size());
+out.put('\n');
+if(!out.finish()) { ... } // handle error
+
+output_plan plan(fields,false,'\t',false); // write the given fields (numbered from 1)
+bool firstout = true;
+plan.write(out,line_fields,firstout); // line_fields: std::vector<std::string> or similar
+out.put('\n');
+
+ */
+
+#ifndef _WRITE_BUFFER_H
+#define _WRITE_BUFFER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "murmurhash.h"
+
+struct write_buffer {
+	public:
+		/* compression of the output (see start_compress()) */
+		enum compression { COMPRESS_NONE, COMPRESS_GZIP, COMPRESS_ZSTD };
+		
+	protected:
+		/* one buffer passed to the writer thread */
+		struct block {
+			char* buf;
+			size_t len;
+			std::vector<char> out; /* compressed data */
+			std::string dict; /* data preceding this block (for gzip) */
+			uint32_t crc; /* CRC-32 of the data (for gzip) */
+			bool taken; /* a compressor thread is working on this block */
+			bool done; /* block is ready to be written */
+		};
+		
+		/* compression of one block, done independently in each thread;
+		 * for gzip, blocks are compressed as parts of one deflate stream
+		 * (ending at byte boundaries, using the end of the previous block
+		 * as dictionary), for zstd, each block is a separate frame */
+		struct block_compressor {
+			compression method;
+			int level;
+#ifndef NO_ZLIB
+			z_stream zs;
+			bool zinit;
+#endif
+#ifdef HAVE_ZSTD
+			ZSTD_CCtx* zc;
+#endif
+			block_compressor(compression method_, int level_):method(method_),level(level_) {
+#ifndef NO_ZLIB
+				zinit = false;
+#endif
+#ifdef HAVE_ZSTD
+				zc = 0;
+#endif
+			}
+			~block_compressor() {
+#ifndef NO_ZLIB
+				if(zinit) deflateEnd(&zs);
+#endif
+#ifdef HAVE_ZSTD
+				if(zc) ZSTD_freeCCtx(zc);
+#endif
+			}
+			/* compress b.buf into b.out; returns 0 or an error code */
+			int compress(block& b) {
+#ifndef NO_ZLIB
+				if(method == COMPRESS_GZIP) {
+					if(!zinit) {
+						memset(&zs,0,sizeof(zs));
+						if(deflateInit2(&zs,level,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY) != Z_OK) return ENOMEM;
+						zinit = true;
+					}
+					else if(deflateReset(&zs) != Z_OK) return EINVAL;
+					if(b.dict.size() && deflateSetDictionary(&zs,(const Bytef*)b.dict.data(),b.dict.size()) != Z_OK)
+						return EINVAL;
+					b.out.resize(deflateBound(&zs,b.len) + 16);
+					zs.next_in = (Bytef*)b.buf;
+					zs.avail_in = b.len;
+					size_t outlen = 0;
+					while(true) {
+						zs.next_out = (Bytef*)b.out.data() + outlen;
+						zs.avail_out = b.out.size() - outlen;
+						int r = deflate(&zs,Z_SYNC_FLUSH);
+						if(r != Z_OK && r != Z_BUF_ERROR) return EINVAL;
+						outlen = b.out.size() - zs.avail_out;
+						if(zs.avail_out) break;
+						b.out.resize(2*b.out.size());
+					}
+					b.out.resize(outlen);
+					b.crc = crc32(0,(const Bytef*)b.buf,b.len);
+					return 0;
+				}
+#endif
+#ifdef HAVE_ZSTD
+				if(method == COMPRESS_ZSTD) {
+					if(!zc) zc = ZSTD_createCCtx();
+					if(!zc) return ENOMEM;
+					b.out.resize(ZSTD_compressBound(b.len));
+					size_t r = ZSTD_compressCCtx(zc,b.out.data(),b.out.size(),b.buf,b.len,level);
+					if(ZSTD_isError(r)) return EINVAL;
+					b.out.resize(r);
+					return 0;
+				}
+#endif
+				(void)b; /* not used if compiled without any compression */
+				return EINVAL;
+			}
+		};
+		
+		/* state of the writer thread if output is written asynchronously:
+		 * buffers are passed to it when full, while the next one is filled;
+		 * if compressing, buffers are compressed by a separate set of
+		 * threads in parallel and the writer thread writes them in order */
+		struct async_writer {
+			std::thread th;
+			std::vector<std::thread> compressors;
+			std::mutex m;
+			std::condition_variable cv; /* signaled when a buffer is filled, compressed or freed */
+			std::deque<block> filled; /* buffers waiting to be written (in order) */
+			std::vector<char*> free_bufs; /* buffers available to be filled */
+			std::vector<char*> all_bufs;
+			bool busy; /* the writer thread is writing a buffer */
+			bool stop;
+			int err;
+			compression method;
+			int level;
+			std::string dict; /* end of the data submitted so far (for gzip) */
+			uint32_t crc; /* CRC-32 of the data written so far (for gzip) */
+			/* statistics */
+			uint64_t blocks; /* number of buffers written */
+			uint64_t stalls; /* number of times no free buffer was available */
+			double stall_time; /* time spent waiting for a free buffer (seconds) */
+			double idle_time; /* time the writer thread spent waiting for data */
+			uint64_t in_bytes; /* bytes of output before and after compression */
+			uint64_t out_bytes;
+			async_writer(compression method_, int level_):busy(false),stop(false),err(0),
+				method(method_),level(level_),crc(0),blocks(0),stalls(0),stall_time(0.0),
+				idle_time(0.0),in_bytes(0),out_bytes(0) { }
+			~async_writer() { for(char* b : all_bufs) free(b); }
+			
+			static double elapsed(std::chrono::steady_clock::time_point t0) {
+				return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			}
+			/* write out data without holding the lock */
+			void write_unlocked(std::unique_lock<std::mutex>& lock, int fd, const char* s, size_t len) {
+				int e = err;
+				lock.unlock();
+				if(!e) write_fd(fd,s,len,e);
+				lock.lock();
+				if(e && !err) err = e;
+				out_bytes += len;
+			}
+			void run(int fd) {
+				std::unique_lock<std::mutex> lock(m);
+#ifndef NO_ZLIB
+				if(method == COMPRESS_GZIP) {
+					/* header: no file name or time stamp, OS: Unix */
+					const char header[10] = {'\x1f','\x8b',8,0,0,0,0,0,0,3};
+					write_unlocked(lock,fd,header,10);
+				}
+#endif
+				while(true) {
+					auto t0 = std::chrono::steady_clock::now();
+					while(!(filled.size() && filled.front().done) && !(stop && filled.empty())) cv.wait(lock);
+					idle_time += elapsed(t0);
+					if(filled.empty()) break;
+					block b = std::move(filled.front());
+					filled.pop_front();
+					busy = true;
+					in_bytes += b.len;
+#ifndef NO_ZLIB
+					if(method == COMPRESS_GZIP) crc = crc32_combine(crc,b.crc,b.len);
+#endif
+					if(method == COMPRESS_NONE) write_unlocked(lock,fd,b.buf,b.len);
+					else write_unlocked(lock,fd,b.out.data(),b.out.size());
+					busy = false;
+					blocks++;
+					free_bufs.push_back(b.buf);
+					cv.notify_all();
+				}
+#ifndef NO_ZLIB
+				if(method == COMPRESS_GZIP) {
+					/* empty final block, CRC-32 and length of the data */
+					char trailer[10] = {3,0};
+					for(int i=0;i<4;i++) trailer[2+i] = (char)(crc >> (8*i));
+					for(int i=0;i<4;i++) trailer[6+i] = (char)(in_bytes >> (8*i));
+					write_unlocked(lock,fd,trailer,10);
+				}
+#endif
+			}
+			void compress_run() {
+				block_compressor c(method,level);
+				std::unique_lock<std::mutex> lock(m);
+				while(true) {
+					block* b = 0;
+					while(true) {
+						for(block& x : filled) if(!x.taken) { b = &x; break; }
+						if(b || stop) break;
+						cv.wait(lock);
+					}
+					if(!b) break;
+					b->taken = true;
+					lock.unlock();
+					int e = c.compress(*b);
+					lock.lock();
+					if(e && !err) err = e;
+					b->done = true;
+					cv.notify_all();
+				}
+			}
+		};
+		
+		char* buf;
+		size_t size; /* size of buf */
+		size_t pos; /* number of bytes in buf */
+		int fd; /* file descriptor to write to */
+		bool own_fd; /* fd was opened by open_file() and is closed by finish() */
+		int err; /* errno of the first error, or 0 */
+		bool finished; /* finish() was called, no more output can be written */
+		std::unique_ptr<async_writer> aw;
+		
+		/* write len bytes from s to fd, handling partial writes and
+		 * interruptions by signals; on error, err is set to errno */
+		static bool write_fd(int fd, const char* s, size_t len, int& err) {
+			while(len) {
+				ssize_t r = ::write(fd,s,len);
+				if(r < 0) {
+					if(errno == EINTR) continue;
+					err = errno;
+					return false;
+				}
+				s += r;
+				len -= r;
+			}
+			return true;
+		}
+		
+		/* write the contents of the buffer followed by len bytes from s
+		 * with one system call (if possible) */
+		bool write_all2(const char* s, size_t len) {
+			if(err) return false;
+			struct iovec iov[2];
+			iov[0].iov_base = buf;
+			iov[0].iov_len = pos;
+			iov[1].iov_base = (void*)s;
+			iov[1].iov_len = len;
+			struct iovec* v = iov;
+			int n = 2;
+			while(n) {
+				ssize_t r = ::writev(fd,v,n);
+				if(r < 0) {
+					if(errno == EINTR) continue;
+					err = errno;
+					return false;
+				}
+				size_t w = r;
+				while(n && w >= v->iov_len) { w -= v->iov_len; v++; n--; }
+				if(n) {
+					v->iov_base = (char*)v->iov_base + w;
+					v->iov_len -= w;
+				}
+			}
+			pos = 0;
+			return true;
+		}
+		
+		/* pass on the contents of the buffer: write it out directly or
+		 * give it to the writer thread and continue with a free buffer */
+		bool submit() {
+			if(!buf || finished) return false;
+			if(!aw) {
+				bool ret = err ? false : write_fd(fd,buf,pos,err);
+				pos = 0;
+				return ret;
+			}
+			std::unique_lock<std::mutex> lock(aw->m);
+			if(pos) {
+				block b;
+				b.buf = buf;
+				b.len = pos;
+				b.crc = 0;
+				b.taken = false;
+				b.done = (aw->method == COMPRESS_NONE);
+				if(aw->method == COMPRESS_GZIP) {
+					/* deflate can refer back to the previous 32 kiB of data */
+					const size_t window = 32768;
+					b.dict = aw->dict;
+					if(pos >= window) aw->dict.assign(buf + pos - window,window);
+					else {
+						aw->dict.append(buf,pos);
+						if(aw->dict.size() > window) aw->dict.erase(0,aw->dict.size() - window);
+					}
+				}
+				aw->filled.push_back(std::move(b));
+				aw->cv.notify_all();
+				if(aw->free_bufs.empty()) {
+					aw->stalls++;
+					auto t0 = std::chrono::steady_clock::now();
+					while(aw->free_bufs.empty()) aw->cv.wait(lock);
+					aw->stall_time += async_writer::elapsed(t0);
+				}
+				buf = aw->free_bufs.back();
+				aw->free_bufs.pop_back();
+				pos = 0;
+			}
+			if(aw->err) err = aw->err;
+			return !err;
+		}
+		
+		/* start the writer thread (and compressor threads if needed) */
+		bool start_thread(unsigned int nbuf, compression method, int level, unsigned int nthreads) {
+			if(aw || !buf || finished || pos) return false;
+			if(nbuf < 2) nbuf = 2;
+			std::unique_ptr<async_writer> a(new async_writer(method,level));
+			a->all_bufs.push_back(buf);
+			for(unsigned int i=1;i<nbuf;i++) {
+				char* b = (char*)malloc(size);
+				if(!b) { a->all_bufs[0] = 0; return false; }
+				a->all_bufs.push_back(b);
+				a->free_bufs.push_back(b);
+			}
+			aw = std::move(a);
+			aw->th = std::thread(&async_writer::run,aw.get(),fd);
+			if(method != COMPRESS_NONE) for(unsigned int i=0;i<nthreads;i++)
+				aw->compressors.emplace_back(&async_writer::compress_run,aw.get());
+			return true;
+		}
+		
+	public:
+		explicit write_buffer(int fd_ = 1, size_t size_ = 1048576):size(size_),pos(0),fd(fd_),own_fd(false),err(0),finished(false) {
+			if(size < 4096) size = 4096;
+			buf = (char*)malloc(size);
+			if(!buf) err = ENOMEM;
+		}
+		~write_buffer() {
+			finish();
+			if(!aw) free(buf); /* else it is one of aw->all_bufs */
+		}
+		write_buffer(const write_buffer&) = delete;
+		write_buffer& operator = (const write_buffer&) = delete;
+		
+		/* write to the given file instead (it is created or truncated);
+		 * has to be called before writing anything; returns false on error
+		 * (see get_error()) */
+		bool open_file(const char* fn) {
+			if(aw || pos || finished) return false;
+			int f = ::open(fn,O_WRONLY | O_CREAT | O_TRUNC,0666);
+			if(f < 0) {
+				err = errno;
+				return false;
+			}
+			if(own_fd) ::close(fd);
+			fd = f;
+			own_fd = true;
+			return true;
+		}
+		
+		/* write output in a separate thread, using nbuf buffers in total
+		 * (at least 2); returns false on error (output is then still
+		 * written directly); has to be called before writing anything */
+		bool start_async(unsigned int nbuf = 4) {
+			return start_thread(nbuf,COMPRESS_NONE,0,0);
+		}
+		/* compress the output using nthreads threads (blocks of the
+		 * buffer size are compressed in parallel), a level of -1 selects
+		 * the default of the method; output is written in a separate
+		 * thread as well; returns false if the method is not supported
+		 * or on error; has to be called before writing anything */
+		bool start_compress(compression method, int level = -1, unsigned int nthreads = 1) {
+			if(nthreads < 1) nthreads = 1;
+			switch(method) {
+#ifndef NO_ZLIB
+				case COMPRESS_GZIP:
+					if(level < 0) level = Z_DEFAULT_COMPRESSION;
+					else if(level > 9) return false;
+					break;
+#endif
+#ifdef HAVE_ZSTD
+				case COMPRESS_ZSTD:
+					if(level < 0) level = ZSTD_CLEVEL_DEFAULT;
+					else if(level > ZSTD_maxCLevel()) return false;
+					break;
+#endif
+				default:
+					return false;
+			}
+			return start_thread(2*nthreads + 2,method,level,nthreads);
+		}
+		/* true if the given compression method is supported in this build */
+		static bool compression_supported(compression method) {
+			switch(method) {
+				case COMPRESS_NONE:
+					return true;
+				case COMPRESS_GZIP:
+#ifndef NO_ZLIB
+					return true;
+#else
+					return false;
+#endif
+				case COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+					return true;
+#else
+					return false;
+#endif
+			}
+			return false;
+		}
+		/* parse a compression method given as NAME[:LEVEL] (e.g. gzip:9);
+		 * returns false if it is invalid (does not check if it is supported) */
+		static bool parse_compression(const char* s, compression& method, int& level) {
+			const char* l = strchr(s,':');
+			size_t len = l ? (size_t)(l - s) : strlen(s);
+			if(len == 4 && !strncmp(s,"gzip",4)) method = COMPRESS_GZIP;
+			else if(len == 4 && !strncmp(s,"zstd",4)) method = COMPRESS_ZSTD;
+			else if(len == 4 && !strncmp(s,"none",4)) method = COMPRESS_NONE;
+			else return false;
+			level = -1;
+			if(l) {
+				char* end = 0;
+				long x = strtol(l + 1,&end,10);
+				if(end == l + 1 || *end || x < 0 || x > 99) return false;
+				level = x;
+			}
+			return true;
+		}
+		
+		/* add len bytes from s to the output */
+		void write(const char* s, size_t len) {
+			if(!len) return;
+			if(len > size - pos) {
+				if(!aw) {
+					if(len >= size/2) { write_all2(s,len); return; }
+					if(!submit()) return;
+				}
+				else while(len > size - pos) {
+					size_t n = size - pos;
+					memcpy(buf + pos,s,n);
+					pos += n;
+					s += n;
+					len -= n;
+					if(!submit()) return;
+				}
+			}
+			memcpy(buf + pos,s,len);
+			pos += len;
+		}
+		void write(const std::string& s) { write(s.data(),s.size()); }
+		/* add one character to the output */
+		void put(char c) {
+			if(pos == size) if(!submit()) return;
+			buf[pos++] = c;
+		}
+		/* write out all buffered output (waiting for the writer thread
+		 * if used); returns false on error (in this case, all further
+		 * output is discarded) */
+		bool flush() {
+			if(finished) return !err;
+			if(!submit()) return false;
+			if(aw) {
+				std::unique_lock<std::mutex> lock(aw->m);
+				while(aw->filled.size() || aw->busy) aw->cv.wait(lock);
+				if(aw->err) err = aw->err;
+			}
+			return !err;
+		}
+		/* write out all buffered output and end the output stream (needed
+		 * if it is compressed), stop the writer thread and close the file
+		 * opened by open_file(); no output can be written after this;
+		 * returns false on error */
+		bool finish() {
+			if(finished) return !err;
+			flush();
+			finished = true;
+			if(aw) {
+				{
+					std::unique_lock<std::mutex> lock(aw->m);
+					aw->stop = true;
+					aw->cv.notify_all();
+				}
+				aw->th.join();
+				for(std::thread& t : aw->compressors) t.join();
+				if(aw->err && !err) err = aw->err;
+			}
+			if(own_fd) {
+				if(::close(fd) && !err) err = errno;
+				own_fd = false;
+			}
+			return !err;
+		}
+		/* errno of the first error (0 if there was no error) */
+		int get_error() const { return err; }
+		const char* get_error_str() const { return strerror(err); }
+		
+		/* write statistics about the writer thread (if used) */
+		void write_stats(std::ostream& s) {
+			if(!aw) return;
+			std::unique_lock<std::mutex> lock(aw->m);
+			s<<"Output buffers written: "<<aw->blocks<<", waited for the writer thread "<<aw->stalls<<
+				" times ("<<aw->stall_time<<" s), writer thread idle for "<<aw->idle_time<<" s\n";
+			if(aw->method != COMPRESS_NONE) s<<"Output compressed from "<<aw->in_bytes<<" to "<<
+				aw->out_bytes<<" bytes using "<<aw->compressors.size()<<" thread(s)\n";
+		}
+};
+
+/*
+ * output split into several files (partitions), each with its own buffer:
+ * each line is written to the one selected by a hash of its key, so that
+ * lines with the same key end up in the same file and the files can be
+ * processed independently (e.g. in parallel)
+ */
+struct partitioned_output {
+	std::vector<std::unique_ptr<write_buffer> > parts;
+	std::vector<std::string> fns; /* file names */
+	
+	/* set up n partitions, written to files named by replacing the first
+	 * %d in pattern with the partition number (counted from 0); the
+	 * buffers use 1 MB each, but at most 16 MB in total (and at least
+	 * 64 kB each); returns false if pattern does not contain %d; files
+	 * are opened by open() */
+	bool init(unsigned int n, const std::string& pattern) {
+		size_t i = pattern.find("%d");
+		if(n < 1 || i == std::string::npos) return false;
+		size_t size = 16*1048576UL / n;
+		if(size > 1048576) size = 1048576;
+		if(size < 65536) size = 65536;
+		parts.clear();
+		fns.clear();
+		for(unsigned int j=0;j<n;j++) {
+			fns.push_back(pattern.substr(0,i) + std::to_string(j) + pattern.substr(i+2));
+			parts.emplace_back(new write_buffer(1,size));
+		}
+		return true;
+	}
+	/* open the file of partition i; returns false on error */
+	bool open(size_t i) { return parts[i]->open_file(fns[i].c_str()); }
+	
+	size_t size() const { return parts.size(); }
+	write_buffer& operator [] (size_t i) { return *parts[i]; }
+	/* output for lines with a key with the given hash */
+	write_buffer& get(uint64_t h) { return *parts[h % parts.size()]; }
+	
+	/* hash of a key given as a sequence of bytes; the same key always
+	 * gives the same hash (independently of the platform if the byte
+	 * order is the same) */
+	static uint64_t hash(const void* key, size_t len) {
+		return MurmurHash64A((const char*)key,len,0x9c2b5e1f3a7d4c61UL);
+	}
+};
+
+/*
+ * plan for writing selected fields of a line, prepared once: consecutive
+ * fields are merged into runs that are copied at once if merge is true
+ * (this is only correct if the input fields are separated by exactly one
+ * character, which is the same as the output separator), and the
+ * separators written in place of a missing line are prepared in advance
+ * 
+ * if all fields are written and whole_line is true, the original line is
+ * written as-is (this requires that the line does not contain anything
+ * else, e.g. comments, besides the fields); in this case, callers do not
+ * need to split the line into fields (see writes_whole_line())
+ * 
+ * if quote is given (CSV output), fields that contain the separator, quote
+ * or a newline are written between quotes (fields are expected to have
+ * any quotes inside escaped already, as returned by line_parser); fields
+ * are never merged in this case
+ */
+struct output_plan {
+	protected:
+		struct run {
+			size_t first; /* indices of the first and last field (from 0) */
+			size_t last;
+		};
+		std::vector<run> runs;
+		bool all; /* write all fields */
+		bool none; /* do not write anything */
+		bool merge;
+		bool whole_line; /* write the original line instead of all fields */
+		char sep;
+		char quote;
+		std::string padding; /* separators written for missing fields */
+		
+		/* write fields using get(i) that returns the start and length of field i;
+		 * runs are copied at once if fields are contiguous in memory */
+		void write_field(write_buffer& sw, const char* s, size_t len) const {
+			if(quote) for(size_t i=0;i<len;i++)
+				if(s[i] == sep || s[i] == quote || s[i] == '\n' || s[i] == '\r') {
+					sw.put(quote);
+					sw.write(s,len);
+					sw.put(quote);
+					return;
+				}
+			sw.write(s,len);
+		}
+		
+		template<class F>
+		void write_impl(write_buffer& sw, size_t n, const F& get, bool contiguous, bool& firstout) const {
+			if(none) return;
+			if(n == 0) { write_empty(sw,firstout); return; }
+			if(all) {
+				if(!firstout) sw.put(sep);
+				if(merge && contiguous) {
+					std::pair<const char*,size_t> a = get(0);
+					std::pair<const char*,size_t> b = get(n-1);
+					sw.write(a.first,b.first + b.second - a.first);
+				}
+				else for(size_t i=0;i<n;i++) {
+					if(i) sw.put(sep);
+					std::pair<const char*,size_t> a = get(i);
+					write_field(sw,a.first,a.second);
+				}
+				firstout = false;
+				return;
+			}
+			for(const run& r : runs) {
+				if(!firstout) sw.put(sep);
+				if(contiguous && !quote) {
+					std::pair<const char*,size_t> a = get(r.first);
+					std::pair<const char*,size_t> b = get(r.last);
+					sw.write(a.first,b.first + b.second - a.first);
+				}
+				else for(size_t i=r.first;i<=r.last;i++) {
+					if(i > r.first) sw.put(sep);
+					std::pair<const char*,size_t> a = get(i);
+					write_field(sw,a.first,a.second);
+				}
+				firstout = false;
+			}
+		}
+		
+		/* add the fields to a binary table one by one */
+		template<class B, class F>
+		void append_impl(B& bw, size_t n, const F& get) const {
+			if(none) return;
+			if(n == 0) { append_empty(bw); return; }
+			if(all) for(size_t i=0;i<n;i++) {
+				std::pair<const char*,size_t> a = get(i);
+				bw.append(a.first,a.second);
+			}
+			else for(const run& r : runs) for(size_t i=r.first;i<=r.last;i++) {
+				std::pair<const char*,size_t> a = get(i);
+				bw.append(a.first,a.second);
+			}
+		}
+		
+	public:
+		output_plan():all(true),none(false),merge(false),whole_line(false),sep('\t'),quote(0) { }
+		/* fields: list of fields to write (numbered from 1, empty means all
+		 * fields); none: do not write any field */
+		output_plan(const std::vector<int>& fields, bool none_, char sep_, bool merge_, bool whole_line_ = false,
+				char quote_ = 0):all(fields.empty()),none(none_),merge(merge_ && !quote_),
+				whole_line(whole_line_ && merge_),sep(sep_),quote(quote_) {
+			for(int f : fields) {
+				size_t i = f - 1;
+				if(merge && runs.size() && runs.back().last + 1 == i) runs.back().last = i;
+				else runs.push_back(run{i,i});
+			}
+			padding.assign(fields.size(),sep);
+		}
+		
+		/* true if the original line is written instead of its fields */
+		bool writes_whole_line() const { return all && whole_line && !none; }
+		/* write the whole line (if writes_whole_line() is true) */
+		void write_line(write_buffer& sw, const char* line, size_t len, bool& firstout) const {
+			if(!firstout) sw.put(sep);
+			sw.write(line,len);
+			firstout = false;
+		}
+		
+		/* write the fields of one line, given as positions in buf */
+		void write(write_buffer& sw, const std::vector<std::pair<size_t,size_t> >& line,
+				const std::string& buf, bool& firstout) const {
+			if(writes_whole_line()) { write_line(sw,buf.data(),buf.size(),firstout); return; }
+			const char* base = buf.data();
+			write_impl(sw,line.size(),[&line,base](size_t i) {
+				return std::pair<const char*,size_t>(base + line[i].first,line[i].second); },true,firstout);
+		}
+		/* write the fields of one line, given as views into the same buffer
+		 * (objects with data() and size() members) */
+		template<class string_view_type>
+		void write(write_buffer& sw, const std::vector<string_view_type>& line, bool& firstout) const {
+			write_impl(sw,line.size(),[&line](size_t i) {
+				return std::pair<const char*,size_t>(line[i].data(),line[i].size()); },true,firstout);
+		}
+		/* same for fields stored separately */
+		void write(write_buffer& sw, const std::vector<std::string>& line, bool& firstout) const {
+			write_impl(sw,line.size(),[&line](size_t i) {
+				return std::pair<const char*,size_t>(line[i].data(),line[i].size()); },false,firstout);
+		}
+		/* write empty fields in place of a missing line */
+		void write_empty(write_buffer& sw, bool& firstout) const {
+			if(none || all) return;
+			if(firstout) sw.write(padding.data() + 1,padding.size() - 1);
+			else sw.write(padding);
+			firstout = false;
+		}
+		
+		/* add the same fields to the current line of a binary table
+		 * instead (B is binary_table_writer, see binary_table.h); the
+		 * whole line is never copied, the caller has to split all fields */
+		template<class B>
+		void append(B& bw, const std::vector<std::pair<size_t,size_t> >& line, const std::string& buf) const {
+			const char* base = buf.data();
+			append_impl(bw,line.size(),[&line,base](size_t i) {
+				return std::pair<const char*,size_t>(base + line[i].first,line[i].second); });
+		}
+		template<class B, class string_view_type>
+		void append(B& bw, const std::vector<string_view_type>& line) const {
+			append_impl(bw,line.size(),[&line](size_t i) {
+				return std::pair<const char*,size_t>(line[i].data(),line[i].size()); });
+		}
+		template<class B>
+		void append_empty(B& bw) const {
+			if(none || all) return;
+			for(size_t i=0;i<padding.size();i++) bw.append("",0);
+		}
+};
+
+#endif